@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -23,33 +23,174 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+// Buffers are hashed by (dev, blockno) into NBUFBUCKET
+// buckets, each with its own lock and its own list of
+// buffers sorted by how recently they were used, so
+// lookups of different blocks proceed in parallel.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+struct {
+  // Serializes moving buffers between buckets. Held
+  // while recycling, before any bucket lock.
+  struct spinlock lock;
+  struct bucket bucket[NBUFBUCKET];
+  int nbuf;
 } bcache;
 
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUFBUCKET];
+}
+
+// Insert b at the most recently used end of bk's list.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Allocate n buffers and store pointers to them in bs.
+// Headers and data blocks are packed into separate pages,
+// so a page holds PGSIZE/BSIZE blocks with nothing left
+// over; what a call leaves of a page, the next one uses.
+// Only called at boot. Returns how many could be allocated.
+int
+bufalloc(struct buf **bs, int n)
+{
+  static struct buf *b;
+  static uchar *d;
+  static int nb, nd;  // unused headers at b, blocks at d
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(nb == 0){
+      if((b = kalloc()) == 0)
+        break;
+      memset(b, 0, PGSIZE);
+      nb = PGSIZE/sizeof(struct buf);
+    }
+    if(nd == 0){
+      if((d = kalloc()) == 0)
+        break;
+      nd = PGSIZE/BSIZE;
+    }
+    initsleeplock(&b->lock, "buffer");
+    b->data = d;
+    bs[i] = b++;
+    nb--;
+    d += BSIZE;
+    nd--;
+  }
+  return i;
+}
+
+// The cache takes 1/BCACHEFRAC of the memory free at boot,
+// counting each buffer's header and block, but never fewer
+// than NBUF buffers.
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *bs[64];
+  struct bucket *bk;
+  int i, n, m;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUFBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  n = free_memory_size() / BCACHEFRAC / (sizeof(struct buf) + BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+
+  // Spread the buffers over the buckets.
+  for(bcache.nbuf = 0; bcache.nbuf < n; ){
+    m = n - bcache.nbuf < NELEM(bs) ? n - bcache.nbuf : NELEM(bs);
+    if(bufalloc(bs, m) != m)
+      panic("binit");
+    for(i = 0; i < m; i++, bcache.nbuf++)
+      bpush(&bcache.bucket[bcache.nbuf % NBUFBUCKET], bs[i]);
+  }
+}
+
+// Look for block on device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// The least recently used unused buffer in bk, or 0.
+// Caller must hold bk->lock.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev){
+    if(b->refcnt == 0)
+      return b;
+  }
+  return 0;
+}
+
+// Give an unused buffer the identity of block blockno on dev,
+// in bucket bk. Recycles the least recently used (LRU) unused
+// buffer, preferring bk, else taking one from another bucket.
+// Returns 0 if every buffer is in use.
+// Caller must hold bcache.lock and bk->lock.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *other;
+
+  if((b = blru(bk)) == 0){
+    for(other = bcache.bucket; other < bcache.bucket+NBUFBUCKET; other++){
+      if(other == bk)
+        continue;
+      acquire(&other->lock);
+      if((b = blru(other)) != 0){
+        bunlink(b);
+        bpush(bk, b);
+      }
+      release(&other->lock);
+      if(b)
+        break;
+    }
+    if(b == 0)
+      return 0;
   }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 0;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +200,58 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk = bucketof(dev, blockno);
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached. Only one cpu at a time recycles, so two
+  // can't both take bucket locks in opposite orders.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // Someone may have cached it while bk was unlocked.
+  if((b = bfind(bk, dev, blockno)) == 0){
+    if((b = brecycle(bk, dev, blockno)) == 0)
+      panic("bget: no buffers");
   }
-  panic("bget: no buffers");
+  b->refcnt++;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Like bget(), but only for a block that isn't cached: returns
+// 0 if it is, or if no buffer is free. Never sleeps waiting
+// for another process's buffer, so the caller may hold
+// several claimed buffers at once.
+static struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk = bucketof(dev, blockno);
+
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if(bfind(bk, dev, blockno) == 0 && (b = brecycle(bk, dev, blockno)) != 0)
+    b->refcnt = 1;
+  else
+    b = 0;
+  release(&bk->lock);
+  release(&bcache.lock);
+  // b was unused, so no one else holds or waits for its lock.
+  if(b)
+    acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +268,71 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n blocks blocknos[] of dev into the cache,
+// skipping those already cached, as one batch of disk requests,
+// and return without waiting for the disk. Returns how many of
+// blocknos[], from the front, are cached or on their way; fewer
+// than n if the disk queue or the cache is full.
+int
+bprefetch(uint dev, uint *blocknos, int n)
+{
+  struct buf *bs[NREADAHEAD], *b;
+  int which[NREADAHEAD];
+  int i, nb, started;
+
+  if(n > NREADAHEAD)
+    n = NREADAHEAD;
+
+  nb = 0;
+  for(i = 0; i < n; i++){
+    struct bucket *bk = bucketof(dev, blocknos[i]);
+    acquire(&bk->lock);
+    b = bfind(bk, dev, blocknos[i]);
+    release(&bk->lock);
+    if(b)
+      continue;
+    if((b = bclaim(dev, blocknos[i])) == 0)
+      break;
+    bs[nb] = b;
+    which[nb] = i;
+    nb++;
+  }
+
+  // each buffer stays locked until bprefetchdone().
+  started = virtio_disk_rwv(bs, nb, 0, 0);
+  for(int j = started; j < nb; j++)
+    brelse(bs[j]);
+  return started < nb ? which[started] : i;
+}
+
+// Return b to the cache once no one uses it.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    bpush(bk, b);
+  }
+  
+  release(&bk->lock);
+}
+
+// Called by virtio_disk_intr() when the read started by
+// bprefetch() has finished. Unlocks b on behalf of the
+// process that started the read.
+void
+bprefetchdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,6 +342,18 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of the n locked buffers in bs to disk
+// together, so the disk can work on all of them at once.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  }
+  virtio_disk_rwv(bs, n, 1, 1);
+}
+
 // Release a locked buffer.
 // Move to the head of the most-recently-used list.
 void
@@ -120,34 +363,25 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
-
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
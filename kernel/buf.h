@@ -7,6 +7,6 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  uchar *data;      // BSIZE bytes, see bufalloc()
 };
 
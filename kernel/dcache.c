@@ -0,0 +1,170 @@
+// Directory name cache.
+//
+// Remembers the results of directory lookups, keyed by
+// (device, directory inode number, name), so that resolving
+// the same paths again does not read the directories again.
+// A negative entry records that a name is not present.
+//
+// Entries are only changed by the holder of the directory's
+// ip->lock, so while a directory is locked its entries agree
+// with its contents:
+// * dirlookup() consults the cache first and fills it in.
+// * dirlink() and sys_unlink() update the entry they change.
+// * itrunc() drops a directory's entries when it is freed,
+//     since its inode number may be used again.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDCBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;              // inode number of the directory, 0 if free
+  char name[DIRSIZ];
+  uint inum;             // 0 for a negative entry
+  uint off;              // byte offset of the dirent in dir
+  int used;              // looked up since the clock hand passed?
+  struct dentry *next;   // next entry in the same bucket
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *bucket[NDCBUCKET];
+  int hand;              // where the eviction scan resumes
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+bucketof(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.bucket[h % NDCBUCKET];
+}
+
+// Find the entry for name in directory (dev, dir).
+// Caller must hold dcache.lock.
+static struct dentry*
+dclookup(uint dev, uint dir, char *name)
+{
+  struct dentry *e;
+
+  for(e = *bucketof(dev, dir, name); e; e = e->next){
+    if(e->dev == dev && e->dir == dir && namecmp(e->name, name) == 0)
+      return e;
+  }
+  return 0;
+}
+
+// Unlink e from its bucket and mark it free.
+// Caller must hold dcache.lock.
+static void
+dcdrop(struct dentry *e)
+{
+  struct dentry **pp;
+
+  for(pp = bucketof(e->dev, e->dir, e->name); *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  e->dir = 0;
+  e->next = 0;
+}
+
+// Find a free entry, evicting one that hasn't been used
+// since the clock hand last passed it if the cache is full.
+// Caller must hold dcache.lock.
+static struct dentry*
+dcalloc(void)
+{
+  struct dentry *e;
+
+  for(;;){
+    e = &dcache.entry[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDCACHE;
+    if(e->dir == 0)
+      return e;
+    if(e->used)
+      e->used = 0;
+    else {
+      dcdrop(e);
+      return e;
+    }
+  }
+}
+
+// Look name up in directory dp. Returns 1 and sets *inum
+// (0 if name is known not to be there) and *off if the
+// answer is cached, else 0. Caller must hold dp->lock.
+int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *e;
+  int found = 0;
+
+  acquire(&dcache.lock);
+  if((e = dclookup(dp->dev, dp->inum, name)) != 0){
+    e->used = 1;
+    *inum = e->inum;
+    *off = e->off;
+    found = 1;
+  }
+  release(&dcache.lock);
+  return found;
+}
+
+// Record that name in directory dp refers to inode inum,
+// found at byte offset off, or is absent if inum is 0.
+// Caller must hold dp->lock.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *e, **b;
+
+  acquire(&dcache.lock);
+  if((e = dclookup(dp->dev, dp->inum, name)) == 0){
+    e = dcalloc();
+    e->dev = dp->dev;
+    e->dir = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+    b = bucketof(dp->dev, dp->inum, name);
+    e->next = *b;
+    *b = e;
+  }
+  e->inum = inum;
+  e->off = off;
+  e->used = 1;
+  release(&dcache.lock);
+}
+
+// Drop all entries of directory dp, because it is
+// being freed. Caller must hold dp->lock.
+void
+dcacheinval(struct inode *dp)
+{
+  struct dentry *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.entry; e < dcache.entry+NDCACHE; e++){
+    if(e->dir == dp->inum && e->dev == dp->dev)
+      dcdrop(e);
+  }
+  release(&dcache.lock);
+}
@@ -26,8 +26,12 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+int             bufalloc(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bprefetch(uint, uint*, int);
+void            bprefetchdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -36,7 +40,10 @@ void            consputc(int);
 extern int top_disabled_at;
 
 // exec.c
+struct execseg;
 int             exec(char*, char**);
+struct execseg* findseg(struct proc*, uint64);
+uint64          loadpage(struct proc*, struct execseg*, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -44,6 +51,7 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
@@ -53,6 +61,8 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            idenywrite(struct inode*);
+void            iallowwrite(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -63,6 +73,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+uint            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -78,8 +89,10 @@ void            kfree(void *);
 void            kinit(void);
 void increment_refcount(void *pa);
 void decrement_refcount(void *pa);
+int get_refcount(void *pa);
 int total_memory_size();
 int free_memory_size();
+void            kmemstats(uint*, uint*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -87,11 +100,25 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(struct inode*, char*, uint*, uint*);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcacheinval(struct inode*);
+
+// pcache.c
+void            pcacheinit(void);
+uint64          pcacheget(struct inode*, uint, uint);
+void            pcacheinval(struct inode*);
+int             pcacheholds(uint64);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipefromi(struct pipe*, struct inode*, uint*, int);
+int             pipetoi(struct pipe*, struct inode*, uint*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -162,17 +189,35 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// start.c
+extern uint64   tickinterval;
+extern int      tickless;
+
 // trap.c
 extern uint     ticks;
+extern uint64   tickbase;
+extern volatile uint64 hrnext;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// timer.c
+void            timertick(void);
+void            timeridle(void);
+void            timerarm(void);
+void            hrtick(void);
+int             tsleep(uint);
+int             hrsleep(uint64);
+uint64          mtime(void);
+
+// fdt.c
+int             bootarg(uint64, char*, int);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+int             uartwrite(int, uint64, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -189,11 +234,15 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+void            uvmusage(pagetable_t, uint64, int*, int*);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             cowfault(pagetable_t, uint64, uint64);
+uint64          vmfault(pagetable_t, uint64);
+void            uvmprefault(uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -204,6 +253,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_rwv(struct buf **, int, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
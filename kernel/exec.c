@@ -7,8 +7,6 @@
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -26,8 +24,10 @@ exec(char *path, char **argv)
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *execip = 0, *oldip;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
@@ -49,7 +49,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments. Nothing is read in
+  // now: vmfault() loads each page from ip on first touch.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,15 +62,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
-      goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr + ph.memsz >= TRAPFRAME || nseg >= NEXECSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to ip for demand paging,
+  // and keep writers off it while it is in use.
+  idenywrite(ip);
+  iunlock(ip);
   end_op();
+  execip = ip;
   ip = 0;
 
   p = myproc();
@@ -121,12 +130,25 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  // p->lock keeps top() off the old page table.
+  acquire(&p->lock);
   oldpagetable = p->pagetable;
+  oldip = p->execip;
   p->pagetable = pagetable;
   p->sz = sz;
+  release(&p->lock);
+  p->execip = execip;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldip){
+    iallowwrite(oldip);
+    begin_op();
+    iput(oldip);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +159,72 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(execip){
+    iallowwrite(execip);
+    begin_op();
+    iput(execip);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+// Return the segment of p's program that contains va,
+// or 0 if there is none.
+struct execseg*
+findseg(struct proc *p, uint64 va)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  struct execseg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz)
+      return s;
   }
-  
   return 0;
 }
+
+// Read the page at va of segment s from p's executable
+// into a new page, and map it. Pages of read-only segments
+// come from the program page cache and are shared by every
+// process running the same binary. May sleep, so the caller
+// must not hold any spinlock or the executable's lock.
+// Returns the page's physical address, or 0 on failure.
+uint64
+loadpage(struct proc *p, struct execseg *s, uint64 va)
+{
+  char *mem;
+  uint64 off;
+  uint n;
+  int r;
+
+  off = va - s->va;
+  n = 0;
+  if(off < s->filesz)
+    n = s->filesz - off < PGSIZE ? s->filesz - off : PGSIZE;
+
+  if((s->perm & PTE_W) == 0 && n > 0){
+    ilock(p->execip);
+    mem = (char*)pcacheget(p->execip, s->off + off, n);
+    iunlock(p->execip);
+    if(mem == 0)
+      return 0;
+  } else {
+    if((mem = kalloc()) == 0)
+      return 0;
+    memset(mem, 0, PGSIZE);
+    if(n > 0){
+      ilock(p->execip);
+      r = readi(p->execip, 0, (uint64)mem, s->off + off, n);
+      iunlock(p->execip);
+      if(r != n){
+        kfree(mem);
+        return 0;
+      }
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|s->perm) != 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
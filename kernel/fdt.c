@@ -0,0 +1,105 @@
+// Read settings from the kernel command line, which qemu
+// (-append) puts in the device tree it passes to the kernel,
+// as the /chosen node's bootargs property.
+// Runs in machine mode from start(), before paging.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+// device tree words are big-endian.
+static uint
+be32(uint64 a)
+{
+  uchar *p = (uchar*)a;
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int
+streq(char *a, char *b)
+{
+  while(*a && *a == *b)
+    a++, b++;
+  return *a == *b;
+}
+
+// The bootargs string in the device tree at dtb, or 0.
+static char*
+bootargs(uint64 dtb)
+{
+  uint64 p, strs;
+  uint tok, len;
+  int depth = 0, chosen = 0;
+  char *name;
+
+  if(dtb == 0 || be32(dtb) != FDT_MAGIC)
+    return 0;
+  p = dtb + be32(dtb + 8);
+  strs = dtb + be32(dtb + 12);
+
+  for(;;){
+    tok = be32(p);
+    p += 4;
+    switch(tok){
+    case FDT_BEGIN_NODE:
+      name = (char*)p;
+      depth++;
+      if(depth == 2 && streq(name, "chosen"))
+        chosen = 1;
+      p += (strlen(name) + 1 + 3) & ~3;
+      break;
+    case FDT_END_NODE:
+      if(depth == 2)
+        chosen = 0;
+      depth--;
+      break;
+    case FDT_PROP:
+      len = be32(p);
+      name = (char*)(strs + be32(p + 4));
+      p += 8;
+      if(chosen && streq(name, "bootargs"))
+        return (char*)p;
+      p += (len + 3) & ~3;
+      break;
+    case FDT_NOP:
+      break;
+    default:
+      return 0;
+    }
+  }
+}
+
+// The value of key=N on the kernel command line,
+// or def if it is not there.
+int
+bootarg(uint64 dtb, char *key, int def)
+{
+  char *s, *k;
+  int n;
+
+  if((s = bootargs(dtb)) == 0)
+    return def;
+  while(*s){
+    while(*s == ' ')
+      s++;
+    for(k = key; *k && *s == *k; k++, s++)
+      ;
+    if(*k == 0 && *s == '='){
+      s++;
+      for(n = 0; *s >= '0' && *s <= '9'; s++)
+        n = n*10 + *s - '0';
+      return n;
+    }
+    while(*s && *s != ' ')
+      s++;
+  }
+  return def;
+}
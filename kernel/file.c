@@ -111,6 +111,9 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // pipes, devices and inodes copy to addr holding locks.
+  uvmprefault(addr, n);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -119,8 +122,19 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    uint off = f->off;
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    // a read that starts where the last one ended looks
+    // like a sequential scan, so start reading the next
+    // blocks before they are asked for.
+    if(r > 0 && off == f->ranext){
+      uint end = f->off + NREADAHEAD*BSIZE;
+      uint start = f->raend > f->off ? f->raend : f->off;
+      if(start < end)
+        f->raend = ireadahead(f->ip, start, end - start);
+    }
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -139,6 +153,9 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  // pipes, devices and inodes copy from addr holding locks.
+  uvmprefault(addr, n);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -180,3 +197,19 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Move up to n bytes between an inode-backed file and a pipe,
+// in either direction, without copying through user memory.
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *fin, struct file *fout, int n)
+{
+  if(fin->readable == 0 || fout->writable == 0 || n < 0)
+    return -1;
+
+  if(fin->type == FD_INODE && fout->type == FD_PIPE)
+    return pipefromi(fout->pipe, fin->ip, &fin->off, n);
+  if(fin->type == FD_PIPE && fout->type == FD_INODE)
+    return pipetoi(fin->pipe, fout->ip, &fout->off, n);
+  return -1;
+}
@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: off after the last read
+  uint raend;        // FD_INODE: read-ahead started up to here
   short major;       // FD_DEVICE
 };
 
@@ -13,11 +15,16 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+#define NBMAP 16      // indirect entries cached per inode
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int denywrite;      // Running programs paging it in; locked like ref
+  struct inode *prev; // LRU list of its itable bucket
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +33,15 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  // entries of the indirect block bmap() used last, so that
+  // sequential access doesn't read it again for every block.
+  uint mapbn;         // file block number of map[0], 0 if none
+  uint map[NBMAP];    // their disk addresses, 0 if not known
+
+  uint goal;          // block to allocate next, 0 if none
+  int pcached;        // may have pages in the program page cache
 };
 
 // map major device number to device functions.
@@ -60,33 +60,72 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
+// Where searches for a free run start. It moves past each
+// run handed out, so that run stays free for the file that
+// got its first block. It is only a hint, so no lock.
+static uint bcursor;
+
+// Find a run of n free blocks, searching from block start and
+// wrapping around, mark the first one in use, and return it.
+// If exact, only a run beginning at start will do.
+// Returns 0 if there is none.
 static uint
-balloc(uint dev)
+btake(uint dev, uint start, int n, int exact)
 {
-  int b, bi, m;
+  int b, bi, i, m, run, nbm;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  nbm = (sb.size + BPB - 1) / BPB;
+  if(start >= sb.size)
+    start = 0;
+  for(i = 0; i <= nbm; i++){
+    b = ((start/BPB + i) % nbm) * BPB;
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    run = 0;
+    for(bi = (i == 0 ? start % BPB : 0); bi < BPB && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+      if(bp->data[bi/8] & m){  // Is block in use?
+        run = 0;
+        if(exact)
+          break;
+        continue;
+      }
+      if(++run == n){
+        bi -= n - 1;
+        bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
         return b + bi;
       }
     }
     brelse(bp);
+    if(exact)
+      break;
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a zeroed disk block, at goal if that is free
+// (0 for no goal), else at the start of a free run of
+// NPREALLOC blocks, else anywhere.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b;
+
+  if(goal == 0 || (b = btake(dev, goal, 1, 1)) == 0){
+    if((b = btake(dev, bcursor, NPREALLOC, 0)) == 0 &&
+       (b = btake(dev, bcursor, 1, 0)) == 0){
+      printf("balloc: out of blocks\n");
+      return 0;
+    }
+    bcursor = b + NPREALLOC;
+  }
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -130,17 +169,19 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is unused if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. Unused entries keep their contents,
+//   and are recycled least recently used first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode, and iget() when it
+//   recycles the entry for another inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,33 +205,90 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is hashed by (dev, inum) into NINODEBUCKET
+// buckets, like the buffer cache. A bucket's spin-lock
+// protects its list and, since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate
+// which i-node an entry holds, those fields of the entries
+// on it. itable.lock serializes moving entries between
+// buckets.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+struct ibucket {
+  struct spinlock lock;
+  // head.next is most recent, head.prev is least.
+  struct inode head;
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ibucket bucket[NINODEBUCKET];
+  int n;
 } itable;
 
+static struct ibucket*
+ibucketof(uint dev, uint inum)
+{
+  return &itable.bucket[(dev * 31 + inum) % NINODEBUCKET];
+}
+
+// Insert ip at the most recently used end of bk's list.
+static void
+ipush(struct ibucket *bk, struct inode *ip)
+{
+  ip->next = bk->head.next;
+  ip->prev = &bk->head;
+  bk->head.next->prev = ip;
+  bk->head.next = ip;
+}
+
+static void
+iunlink(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// The table takes 1/ICACHEFRAC of the memory free at boot,
+// but has at least NINODE entries.
 void
 iinit()
 {
-  int i = 0;
-  
+  struct ibucket *bk;
+  struct inode *ip;
+  int i, n;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  for(bk = itable.bucket; bk < itable.bucket+NINODEBUCKET; bk++){
+    initlock(&bk->lock, "itable.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  n = free_memory_size() / ICACHEFRAC / sizeof(struct inode);
+  if(n < NINODE)
+    n = NINODE;
+
+  // Spread the entries over the buckets.
+  for(itable.n = 0; itable.n < n; ){
+    if((ip = kalloc()) == 0)
+      panic("iinit");
+    memset(ip, 0, PGSIZE);
+    for(i = 0; i < PGSIZE / sizeof(struct inode) && itable.n < n; i++){
+      initsleeplock(&ip[i].lock, "inode");
+      ipush(&itable.bucket[itable.n++ % NINODEBUCKET], &ip[i]);
+    }
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Where ialloc() resumes its search. Only a hint, so no lock.
+static uint icursor;
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -198,11 +296,14 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // start after the inode allocated last, rather than
+  // passing over all the ones in use every time.
+  for(i = 1; i < sb.ninodes; i++){
+    inum = (icursor + i - 1) % (sb.ninodes - 1) + 1;
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -210,6 +311,7 @@ ialloc(uint dev, short type)
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      icursor = inum;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -240,37 +342,87 @@ iupdate(struct inode *ip)
   brelse(bp);
 }
 
+// Look for inode inum of device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head.next; ip != &bk->head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+  }
+  return 0;
+}
+
+// The least recently used unused entry in bk, or 0.
+// Caller must hold bk->lock.
+static struct inode*
+ilru(struct ibucket *bk)
+{
+  struct inode *ip;
+
+  for(ip = bk->head.prev; ip != &bk->head; ip = ip->prev){
+    if(ip->ref == 0)
+      return ip;
+  }
+  return 0;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk = ibucketof(dev, inum), *other;
 
-  acquire(&itable.lock);
+  acquire(&bk->lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  if((ip = ifind(bk, dev, inum)) != 0){
+    ip->ref++;
+    release(&bk->lock);
+    return ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
-  ip->dev = dev;
-  ip->inum = inum;
-  ip->ref = 1;
-  ip->valid = 0;
+  // Not there. Only one cpu at a time recycles, so two
+  // can't both take bucket locks in opposite orders.
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+
+  // Someone may have added it while bk was unlocked.
+  if((ip = ifind(bk, dev, inum)) == 0){
+    // Recycle the least recently used unused entry,
+    // preferring this bucket, else taking one from another.
+    if((ip = ilru(bk)) == 0){
+      for(other = itable.bucket; other < itable.bucket+NINODEBUCKET; other++){
+        if(other == bk)
+          continue;
+        acquire(&other->lock);
+        if((ip = ilru(other)) != 0){
+          iunlink(ip);
+          ipush(bk, ip);
+        }
+        release(&other->lock);
+        if(ip)
+          break;
+      }
+      if(ip == 0)
+        panic("iget: no inodes");
+    }
+    // its cached pages can't be found from a new inode.
+    pcacheinval(ip);
+    ip->dev = dev;
+    ip->inum = inum;
+    ip->ref = 0;
+    ip->valid = 0;
+  }
+  ip->ref++;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -281,12 +433,41 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
+// A program running from ip reads its pages in from the
+// file as it touches them, so ip must not change until
+// every process running it has let go. writei() and
+// itrunc() refuse while denywrite is set; exec() sets it
+// with ip locked, so a writer holding the lock sees it.
+void
+idenywrite(struct inode *ip)
+{
+  struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
+  ip->denywrite++;
+  release(&bk->lock);
+}
+
+void
+iallowwrite(struct inode *ip)
+{
+  struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
+  if(ip->denywrite < 1)
+    panic("iallowwrite");
+  ip->denywrite--;
+  release(&bk->lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -299,6 +480,7 @@ ilock(struct inode *ip)
     panic("ilock");
 
   acquiresleep(&ip->lock);
+  myproc()->ilocks++;
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -309,6 +491,8 @@ ilock(struct inode *ip)
     ip->nlink = dip->nlink;
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->mapbn = 0;
+    ip->goal = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -323,6 +507,7 @@ iunlock(struct inode *ip)
   if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
+  myproc()->ilocks--;
   releasesleep(&ip->lock);
 }
 
@@ -336,7 +521,9 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = ibucketof(ip->dev, ip->inum);
+
+  acquire(&bk->lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,7 +532,7 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
     itrunc(ip);
     ip->type = 0;
@@ -354,11 +541,16 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
   ip->ref--;
-  release(&itable.lock);
+  if(ip->ref == 0){
+    // no one is using it; keep it as most recently used.
+    iunlink(ip);
+    ipush(bk, ip);
+  }
+  release(&bk->lock);
 }
 
 // Common idiom: unlock, then put.
@@ -374,7 +566,23 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after that are listed in the indirect blocks listed in
+// block ip->addrs[NDIRECT+1].
+
+static uint bmapind(struct inode*, uint, uint, uint);
+
+// Allocate a block for ip, right after the one it got last
+// if possible, so its blocks end up contiguous on disk.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  if((addr = balloc(ip->dev, ip->goal)) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -387,47 +595,120 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
     return addr;
   }
+
+  // Resolved through the same indirect block last time?
+  if(ip->mapbn && bn - ip->mapbn < NBMAP && (addr = ip->map[bn - ip->mapbn]) != 0)
+    return addr;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
     }
+    return bmapind(ip, addr, bn, NDIRECT);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block
+    // it points to, allocating if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0){
+      addr = iballoc(ip);
+      if(addr == 0)
+        return 0;
+      ip->addrs[NDIRECT+1] = addr;
+    }
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = a[bn / NINDIRECT]) == 0){
+      addr = iballoc(ip);
       if(addr){
-        a[bn] = addr;
+        a[bn / NINDIRECT] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+    return bmapind(ip, addr, bn % NINDIRECT,
+                   NDIRECT + NINDIRECT + bn - bn % NINDIRECT);
   }
 
   panic("bmap: out of range");
 }
 
+// Return the address in entry i of indirect block ind,
+// allocating the data block if necessary, and remember the
+// NBMAP entries around it in ip->map. first is the file
+// block number that entry 0 maps.
+static uint
+bmapind(struct inode *ip, uint ind, uint i, uint first)
+{
+  uint addr, *a, w;
+  struct buf *bp;
+
+  bp = bread(ip->dev, ind);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = iballoc(ip);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  w = i - i % NBMAP;
+  memmove(ip->map, a + w, sizeof(ip->map));
+  ip->mapbn = first + w;
+  brelse(bp);
+  return addr;
+}
+
+// Free indirect block ind and the blocks it points to;
+// depth 2 for a double-indirect block.
+static void
+itruncind(struct inode *ip, uint ind, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(ip->dev, ind);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      itruncind(ip, a[j], depth - 1);
+    else
+      bfree(ip->dev, a[j]);
+  }
+  brelse(bp);
+  bfree(ip->dev, ind);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->denywrite)
+    panic("itrunc: running program");
+  pcacheinval(ip);
+  if(ip->type == T_DIR)
+    dcacheinval(ip);
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,17 +717,13 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 2; i++){
+    if(ip->addrs[NDIRECT+i]){
+      itruncind(ip, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->mapbn = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -495,6 +772,33 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading the blocks that hold [off, off+n) of ip into
+// the buffer cache, without waiting for the disk.
+// Caller must hold ip->lock.
+// Returns the offset up to which reads were started.
+uint
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint addrs[NREADAHEAD];
+  int nb, done;
+
+  if(off >= ip->size || off + n < off)
+    return off;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  // look up all the blocks first, since bmap() may itself
+  // read, then hand them to the disk as one batch.
+  n += off % BSIZE;
+  off -= off % BSIZE;
+  for(nb = 0; nb < NREADAHEAD && nb*BSIZE < n; nb++){
+    if((addrs[nb] = bmap(ip, off/BSIZE + nb)) == 0)
+      break;
+  }
+  done = bprefetch(ip->dev, addrs, nb);
+  return off + done*BSIZE;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -512,6 +816,11 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  // a running program pages its text in from here.
+  if(ip->denywrite)
+    return -1;
+
+  pcacheinval(ip);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -546,6 +855,133 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Is dp a hashed directory, and name one that lives in its
+// chains rather than at the start of block 0?
+static int
+dirhashed(struct inode *dp, char *name)
+{
+  return dp->major == DIRHASHED &&
+    namecmp(name, ".") != 0 && namecmp(name, "..") != 0;
+}
+
+// Return the dirhead slot holding the head of name's chain
+// in block 0 of a hashed directory, and set *i to the index
+// of the head within it.
+static struct dirhead*
+dirheadof(struct buf *bp, char *name, int *i)
+{
+  uint h = dirhash(name);
+
+  *i = h % 3;
+  return (struct dirhead*)bp->data + 2 + h / 3;
+}
+
+// Look for name in the hash chain of hashed directory dp.
+// If found, set *inum and *poff and return 1, else return 0.
+static int
+dirhfind(struct inode *dp, char *name, uint *inum, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint fbn;
+  int i;
+
+  if(dp->size < BSIZE)
+    return 0;  // no chains yet
+  bp = bread(dp->dev, bmap(dp, 0));
+  fbn = dirheadof(bp, name, &i)->fbn[i];
+  brelse(bp);
+
+  while(fbn != 0){
+    if(fbn >= dp->size / BSIZE)
+      panic("dirhfind");
+    bp = bread(dp->dev, bmap(dp, fbn));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB-1; i++){
+      if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+        *inum = de[i].inum;
+        *poff = fbn*BSIZE + i*sizeof(*de);
+        brelse(bp);
+        return 1;
+      }
+    }
+    fbn = ((struct dirhead*)de)[DPB-1].fbn[0];
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Add (name, inum) to the first free slot in name's chain
+// of hashed directory dp, adding a block to the chain if
+// they are all full. Returns 0 on success, -1 on failure.
+static int
+dirhlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dirhead *dh;
+  uint fbn, prev, addr;
+  int i, hi;
+
+  // the chain heads live in block 0, after "." and "..".
+  if(dp->size < BSIZE){
+    dp->size = BSIZE;
+    iupdate(dp);
+  }
+
+  prev = 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  fbn = dirheadof(bp, name, &hi)->fbn[hi];
+  brelse(bp);
+
+  while(fbn != 0){
+    bp = bread(dp->dev, bmap(dp, fbn));
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB-1; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        dcacheenter(dp, name, inum, fbn*BSIZE + i*sizeof(*de));
+        return 0;
+      }
+    }
+    prev = fbn;
+    fbn = ((struct dirhead*)de)[DPB-1].fbn[0];
+    brelse(bp);
+  }
+
+  // every block of the chain is full; add one at the end
+  // of the directory.
+  fbn = dp->size / BSIZE;
+  if(fbn >= MAXFILE || (addr = bmap(dp, fbn)) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+
+  bp = bread(dp->dev, addr);  // zeroed by balloc()
+  de = (struct dirent*)bp->data;
+  strncpy(de[0].name, name, DIRSIZ);
+  de[0].inum = inum;
+  log_write(bp);
+  brelse(bp);
+
+  bp = bread(dp->dev, bmap(dp, prev));
+  if(prev == 0)
+    dh = dirheadof(bp, name, &hi);
+  else {
+    dh = (struct dirhead*)bp->data + DPB-1;
+    hi = 0;
+  }
+  dh->fbn[hi] = fbn;
+  log_write(bp);
+  brelse(bp);
+
+  dcacheenter(dp, name, inum, fbn*BSIZE);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -557,6 +993,25 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dirhashed(dp, name)){
+    if(dirhfind(dp, name, &inum, &off) == 0){
+      dcacheenter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = off;
+    dcacheenter(dp, name, inum, off);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1022,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -589,6 +1046,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dirhashed(dp, name))
+    return dirhlink(dp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -601,6 +1061,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
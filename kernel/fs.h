@@ -24,9 +24,10 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +36,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses; then the
+                           // indirect and double-indirect blocks
 };
 
 // Inodes per block.
@@ -58,3 +60,34 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory whose dinode major is DIRHASHED keeps its
+// entries in hash chains rather than one flat array.
+// Block 0 holds "." and "..", then dirheads holding the
+// file block numbers of the first block of each chain.
+// Each chain block holds DPB-1 dirents, then a dirhead
+// whose fbn[0] is the next block of the chain (0 for none).
+// A dirhead reads as an empty dirent, so the directory
+// can still be read as an array of dirents.
+#define DIRHASHED 1
+#define NDIRBUCKET ((DPB - 2) * 3)
+
+struct dirhead {
+  ushort inum;  // always 0
+  ushort pad;
+  uint fbn[3];
+};
+
+// Which chain of a hashed directory holds name.
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261u;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h % NDIRBUCKET;
+}
@@ -14,6 +14,9 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
 // defined by kernel.ld.
 
+#define NKCACHE     64  // max free pages held by one cpu's cache
+#define KCACHEBATCH 32  // pages moved between a cache and kmem at once
+
 struct run {
     struct run *next;
 };
@@ -21,11 +24,26 @@ struct run {
 struct {
     struct spinlock lock;
     struct run *freelist;
-    int refcount[(PHYSTOP >> PGSHIFT)]; // Array to keep track of reference counts
     int total_pages; // Total number of pages
-    int free_pages;  // Number of free pages
+    int free_pages;  // Number of free pages on freelist
 } kmem;
 
+// Reference counts of physical pages, kept apart from
+// kmem and only updated with atomic instructions, so
+// sharing or unsharing a page takes no lock at all.
+struct {
+    int refcount[(PHYSTOP >> PGSHIFT)]; // Array to keep track of reference counts
+} ref;
+
+// A per-cpu cache of free pages in front of kmem.
+// Only the owning cpu adds to it; other cpus take
+// from it only when kmem runs dry.
+struct kcache {
+    struct spinlock lock;
+    struct run *freelist;
+    int n;           // Number of pages on freelist
+} kcache[NCPU];
+
 
 int
 total_memory_size()
@@ -43,20 +61,34 @@ total_memory_size()
 int
 free_memory_size()
 {
-    int x_free_memory_size;
+    int x_free_pages;
     acquire(&kmem.lock);
 
-    x_free_memory_size = kmem.free_pages * PGSIZE;
+    x_free_pages = kmem.free_pages;
 
     release(&kmem.lock);
 
-    return x_free_memory_size;
+    // Pages sitting in per-cpu caches are free too.
+    for (int i = 0; i < NCPU; i++)
+        x_free_pages += kcache[i].n;
+
+    return x_free_pages * PGSIZE;
+}
+
+// Contention counters of the global free-list lock.
+void
+kmemstats(uint *nacquire, uint *ncontend)
+{
+    *nacquire = kmem.lock.nacquire;
+    *ncontend = kmem.lock.ncontend;
 }
 
 void
 kinit()
 {
     initlock(&kmem.lock, "kmem");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&kcache[i].lock, "kcache");
     kmem.total_pages = 0;
     kmem.free_pages = 0;
     freerange(end, (void*)PHYSTOP);
@@ -67,8 +99,60 @@ freerange(void *pa_start, void *pa_end)
 {
     char *p;
     p = (char*)PGROUNDUP((uint64)pa_start);
-    for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+    for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE) {
+        kmem.total_pages++;
+        ref.refcount[((uint64)p) >> PGSHIFT] = 1;
         kfree(p);
+    }
+}
+
+// Move up to n pages from kmem to cache c.
+// Caller must hold c->lock.
+static void
+refill(struct kcache *c, int n)
+{
+    struct run *r;
+
+    acquire(&kmem.lock);
+    while (n-- > 0 && (r = kmem.freelist) != 0) {
+        kmem.freelist = r->next;
+        kmem.free_pages--;
+        r->next = c->freelist;
+        c->freelist = r;
+        c->n++;
+    }
+    release(&kmem.lock);
+}
+
+// Move n pages from cache c back to kmem.
+// Caller must hold c->lock.
+static void
+drain(struct kcache *c, int n)
+{
+    struct run *r;
+
+    acquire(&kmem.lock);
+    while (n-- > 0 && (r = c->freelist) != 0) {
+        c->freelist = r->next;
+        c->n--;
+        r->next = kmem.freelist;
+        kmem.freelist = r;
+        kmem.free_pages++;
+    }
+    release(&kmem.lock);
+}
+
+// Drop one reference to the page at pa.
+// Returns 1 if that was the last one.
+static int
+putref(void *pa)
+{
+    uint64 pa_index = ((uint64)pa) >> PGSHIFT;
+    int n = __sync_sub_and_fetch(&ref.refcount[pa_index], 1);
+
+    if(n < 0)
+        panic("kfree: refcount");
+    return n == 0;
 }
 
 // Free the page of physical memory pointed at by pa,
@@ -79,31 +163,29 @@ void
 kfree(void *pa)
 {
     struct run *r;
+    struct kcache *c;
 
     if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
         panic("kfree");
 
-    acquire(&kmem.lock);
-
-    uint64 pa_index = ((uint64)pa) >> PGSHIFT;
-    if(kmem.refcount[pa_index] > 1) {
-        kmem.refcount[pa_index]--;
-    } else {
-        // Fill with junk to catch dangling refs.
-        memset(pa, 1, PGSIZE);
-        kmem.refcount[pa_index] = 0;
-
-        kmem.free_pages++; // Increment free_pages
+    if(!putref(pa))
+        return;
 
-        if (kmem.free_pages > kmem.total_pages)
-            kmem.total_pages = kmem.free_pages;
+    // Fill with junk to catch dangling refs.
+    memset(pa, 1, PGSIZE);
 
-        r = (struct run*)pa;
-        r->next = kmem.freelist;
-        kmem.freelist = r;
-    }
+    r = (struct run*)pa;
 
-    release(&kmem.lock);
+    push_off();
+    c = &kcache[cpuid()];
+    acquire(&c->lock);
+    if(c->n >= NKCACHE)
+        drain(c, KCACHEBATCH);
+    r->next = c->freelist;
+    c->freelist = r;
+    c->n++;
+    release(&c->lock);
+    pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -113,39 +195,55 @@ void *
 kalloc(void)
 {
     struct run *r;
-
-    acquire(&kmem.lock);
-    r = kmem.freelist;
-    if(r) {
-        kmem.free_pages--; // Decrement free_pages
-        kmem.freelist = r->next;
-        uint64 pa_index = ((uint64)r) >> PGSHIFT;
-        kmem.refcount[pa_index] = 1; // Initialize refcount to 1 for newly allocated page
+    struct kcache *c;
+    int id;
+
+    push_off();
+    id = cpuid();
+    c = &kcache[id];
+    acquire(&c->lock);
+    if(c->n == 0)
+        refill(c, KCACHEBATCH);
+    if((r = c->freelist) != 0) {
+        c->freelist = r->next;
+        c->n--;
     }
-    release(&kmem.lock);
+    release(&c->lock);
+
+    // kmem is empty; take a page from another cpu's cache.
+    for(int i = 0; r == 0 && i < NCPU; i++) {
+        if(i == id)
+            continue;
+        c = &kcache[i];
+        acquire(&c->lock);
+        if((r = c->freelist) != 0) {
+            c->freelist = r->next;
+            c->n--;
+        }
+        release(&c->lock);
+    }
+    pop_off();
 
-    if(r)
+    if(r) {
+        // No one else can see r yet, so a plain store will do.
+        ref.refcount[((uint64)r) >> PGSHIFT] = 1; // Initialize refcount to 1 for newly allocated page
         memset((char*)r, 5, PGSIZE); // fill with junk
+    }
     return (void*)r;
 }
 
 // Increment the reference count of the physical page at pa
 void increment_refcount(void *pa) {
-    acquire(&kmem.lock);
     uint64 pa_index = ((uint64)pa) >> PGSHIFT;
-    kmem.refcount[pa_index]++;
-    release(&kmem.lock);
+    __sync_fetch_and_add(&ref.refcount[pa_index], 1);
+}
+
+// Return the reference count of the physical page at pa
+int get_refcount(void *pa) {
+    return ref.refcount[((uint64)pa) >> PGSHIFT];
 }
 
 // Decrement the reference count of the physical page at pa
 void decrement_refcount(void *pa) {
-    acquire(&kmem.lock);
-    uint64 pa_index = ((uint64)pa) >> PGSHIFT;
-    if (kmem.refcount[pa_index] > 0) {
-        kmem.refcount[pa_index]--;
-        if (kmem.refcount[pa_index] == 0) {
-            kfree(pa);
-        }
-    }
-    release(&kmem.lock);
+    kfree(pa);
 }
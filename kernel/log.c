@@ -10,8 +10,8 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is sealed for commit only when there are
+// no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -19,7 +19,13 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the open transaction has been handed to commit.
+//
+// The log is double-buffered in memory. Sealing a transaction
+// snapshots its blocks, after which new system calls go on
+// into the next transaction while the sealed one is written
+// to the log and installed. System calls that finish while
+// a commit is in progress are grouped into the next one.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +34,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Each commit writes all its log blocks, and then all its
+// home blocks, as one batch of disk requests.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,14 +48,23 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // max blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // a commit() is in progress.
+  int sealing;     // commit() is taking its snapshot, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction
+  struct logheader clh; // the transaction being committed
+  struct buf *pinned[LOGSIZE]; // cache buffers of clh's blocks
+  struct buf *shadow[LOGSIZE]; // snapshot of clh's blocks
 };
 struct log log;
 
+// how many blocks recovery copies to the disk at once.
+#define LOGBATCH 16
+
 static void recover_from_log(void);
+static void seal(void);
 static void commit();
 
 void
@@ -61,24 +77,38 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+
+  // the log's size comes from mkfs; one block is the header.
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
+  if (log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  if (bufalloc(log.shadow, log.cap) != log.cap)
+    panic("initlog: shadow");
+  for (int i = 0; i < log.cap; i++)
+    log.shadow[i]->dev = dev;
+
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Used only by recovery.
 static void
-install_trans(int recovering)
+install_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *dbufs[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbufs[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbufs[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbufs, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbufs[i]);
   }
 }
 
@@ -96,18 +126,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write in-memory log header lh to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,9 +147,9 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_log(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -128,9 +158,9 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.sealing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -142,7 +172,9 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless a commit is already running; that one will
+// pick up this transaction when it is done.
 void
 end_op(void)
 {
@@ -150,11 +182,12 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && !log.committing && log.lh.n > 0){
     do_commit = 1;
     log.committing = 1;
+    // seal before releasing the lock, so that no
+    // begin_op() can slip into the transaction.
+    seal();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -167,44 +200,102 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the sealed transaction's blocks out of the cache,
+// so the next transaction may change them while these
+// are being written.
+static void
+snapshot(void)
+{
+  int i;
+
+  for (i = 0; i < log.clh.n; i++) {
+    struct buf *b = bread(log.dev, log.clh.block[i]); // cache block
+    acquiresleep(&log.shadow[i]->lock);
+    memmove(log.shadow[i]->data, b->data, BSIZE);
+    log.pinned[i] = b;  // stays pinned until installed
+    brelse(b);
+  }
+}
+
+// Write the snapshot to the log.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  int i;
+
+  for (i = 0; i < log.clh.n; i++)
+    log.shadow[i]->blockno = log.start+i+1;
+  bwritev(log.shadow, log.clh.n);
+}
+
+// Write the snapshot to its home locations. The cache
+// buffers may hold newer changes by now, so write the
+// snapshot rather than them.
+static void
+install_trans(void)
+{
+  int i;
+
+  for (i = 0; i < log.clh.n; i++)
+    log.shadow[i]->blockno = log.clh.block[i];
+  bwritev(log.shadow, log.clh.n);
+  for (i = 0; i < log.clh.n; i++) {
+    bunpin(log.pinned[i]);
+    releasesleep(&log.shadow[i]->lock);
   }
 }
 
+// Make the open transaction the one to commit, and hold
+// off begin_op() until snapshot() has copied its blocks.
+// Caller must hold log.lock and have seen outstanding == 0,
+// so no FS sys call is in the transaction.
+static void
+seal(void)
+{
+  if (log.outstanding != 0)
+    panic("seal");
+  log.sealing = 1;
+  log.clh = log.lh;
+  log.lh.n = 0;
+}
+
+// Commit the sealed transaction, and then any that built up
+// while it was being written, until one is still in use.
+// Caller must have set log.committing and called seal().
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  while (1) {
+    snapshot();
+
+    acquire(&log.lock);
+    log.sealing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log();        // Write snapshot to log
+    write_head(&log.clh); // Write header to disk -- the real commit
+    install_trans();    // Now install writes to home locations
+    log.clh.n = 0;
+    write_head(&log.clh); // Erase the transaction from the log
+
+    acquire(&log.lock);
+    if (log.outstanding > 0 || log.lh.n == 0)
+      break;
+    seal();
+    release(&log.lock);
   }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/snapshot() will copy it out for the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +308,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -2,12 +2,27 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of active i-nodes
+#define NINODEBUCKET 31  // hash buckets in the inode table
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      254  // max data blocks in on-disk log
+#define NBUF         256  // minimum size of disk block cache
+#define BCACHEFRAC   32   // block cache gets 1/BCACHEFRAC of free memory
+#define ICACHEFRAC   256  // inode table gets 1/ICACHEFRAC of free memory
+#define NBUFBUCKET   31   // hash buckets in the block cache
+#define NREADAHEAD   8    // blocks read ahead of a sequential reader
+#define NPREALLOC    8    // free run set aside for a file to grow into
+#define FSSIZE       2000  // default size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NCOWAROUND   4     // extra COW pages resolved per write fault
+#define NEXECSEG     4     // max loadable segments in a program
+#define NPCACHE      256   // max cached pages of program text
+#define NDCACHE      512   // max cached directory lookups
+#define NPIPEPAGE    4     // pages of buffer per pipe; a power of two
+#define NSLEEPQ      61    // hash buckets of sleeping processes
+#define TICKHZ       10    // default clock ticks per second; boot arg hz=
+#define TICKLESS     1     // default for boot arg tickless=: idle harts stop ticking
+#define UART_TX_BUF_SIZE 1024 // bytes of console output waiting for the UART
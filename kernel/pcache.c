@@ -0,0 +1,196 @@
+// Program page cache.
+//
+// Holds pages of read-only program segments, keyed by
+// (device, inode number, file offset), so that every process
+// running the same binary maps the same physical text pages
+// instead of reading in its own copy.
+//
+// The cache owns one reference (see kalloc.c) to each page it
+// holds, and every page table that maps the page owns another.
+// A page whose only reference is the cache's is unused and may
+// be evicted to make room.
+//
+// Interface:
+// * pcacheget() returns a page with a reference for the caller.
+// * pcacheinval() drops an inode's pages; writei() and itrunc()
+//     call it so a rewritten binary is read in again, but only
+//     for inodes marked pcached, so other files skip the lock.
+// * pcacheholds() says whether a page's references include
+//     the cache's, for telling shared pages from private ones.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCBUCKET 31
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;
+  uint64 pa;             // 0 if this entry is free
+  struct pcpage *next;   // next page of an inode in the same bucket
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *bucket[NPCBUCKET];  // pages hashed by inode
+  int hand;              // where the eviction scan resumes
+  // one bit per physical page: does the cache hold it?
+  uint64 held[((PHYSTOP - KERNBASE) >> PGSHIFT) / 64];
+} pcache;
+
+#define HELDBIT(pa) (((pa) - KERNBASE) >> PGSHIFT)
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct pcpage**
+bucketof(uint dev, uint inum)
+{
+  return &pcache.bucket[(dev * 31 + inum) % NPCBUCKET];
+}
+
+// Unlink e from its bucket and drop the cache's reference.
+// Caller must hold pcache.lock.
+static void
+pcdrop(struct pcpage *e)
+{
+  struct pcpage **pp;
+
+  for(pp = bucketof(e->dev, e->inum); *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  pcache.held[HELDBIT(e->pa) / 64] &= ~(1L << (HELDBIT(e->pa) % 64));
+  kfree((void*)e->pa);
+  e->pa = 0;
+  e->next = 0;
+}
+
+// Find the cached page at off of inode (dev, inum).
+// Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(uint dev, uint inum, uint off)
+{
+  struct pcpage *e;
+
+  for(e = *bucketof(dev, inum); e; e = e->next){
+    if(e->dev == dev && e->inum == inum && e->off == off)
+      return e;
+  }
+  return 0;
+}
+
+// Find a free entry, evicting a page that nobody maps
+// if the cache is full. Returns 0 if every page is in use.
+// Caller must hold pcache.lock.
+static struct pcpage*
+pcalloc(void)
+{
+  struct pcpage *e;
+  int i;
+
+  for(i = 0; i < 2*NPCACHE; i++){
+    e = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(e->pa == 0)
+      return e;
+    // on the second pass, take any page only the cache holds.
+    if(i >= NPCACHE && get_refcount((void*)e->pa) == 1){
+      pcdrop(e);
+      return e;
+    }
+  }
+  return 0;
+}
+
+// Return a page holding the n bytes at off of ip, zero-filled
+// after that, with a reference for the caller. The page must
+// never be written. Caller must hold ip->lock.
+// Returns 0 if out of memory or the read fails.
+uint64
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *e;
+  char *mem;
+  uint64 pa;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip->dev, ip->inum, off)) != 0){
+    pa = e->pa;
+    increment_refcount((void*)pa);
+    release(&pcache.lock);
+    return pa;
+  }
+  release(&pcache.lock);
+
+  // readi() may sleep, so read the page in without the lock.
+  // Holding ip->lock keeps others from inserting it meanwhile.
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&pcache.lock);
+  if((e = pcalloc()) != 0){
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+    e->off = off;
+    e->pa = (uint64)mem;
+    e->next = *bucketof(ip->dev, ip->inum);
+    *bucketof(ip->dev, ip->inum) = e;
+    increment_refcount(mem);
+    pcache.held[HELDBIT(e->pa) / 64] |= 1L << (HELDBIT(e->pa) % 64);
+    ip->pcached = 1;
+  }
+  release(&pcache.lock);
+
+  // if the cache was full, the caller gets a private page.
+  return (uint64)mem;
+}
+
+// Drop all cached pages of ip, because its contents are
+// about to change. Processes that still map them keep
+// their old copies.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage **pp, *e;
+
+  if(!ip->pcached)
+    return;
+  ip->pcached = 0;
+  acquire(&pcache.lock);
+  pp = bucketof(ip->dev, ip->inum);
+  while((e = *pp) != 0){
+    if(e->dev == ip->dev && e->inum == ip->inum)
+      pcdrop(e);
+    else
+      pp = &e->next;
+  }
+  release(&pcache.lock);
+}
+
+// Does the cache hold one of pa's references? Read without
+// the lock; the answer is only used for statistics.
+int
+pcacheholds(uint64 pa)
+{
+  return (pcache.held[HELDBIT(pa) / 64] >> (HELDBIT(pa) % 64)) & 1;
+}
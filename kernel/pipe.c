@@ -8,17 +8,53 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (NPIPEPAGE*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[NPIPEPAGE];  // ring buffer of PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // pipetoi() is copying out of the ring
+  int wbusy;      // pipefromi() is copying into the ring
 };
 
+// Free pi and its buffer pages.
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < NPIPEPAGE; i++){
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  }
+  kfree((char*)pi);
+}
+
+// Where byte number off of the stream is kept in the ring.
+static char*
+pipeaddr(struct pipe *pi, uint off)
+{
+  off %= PIPESIZE;
+  return pi->page[off / PGSIZE] + off % PGSIZE;
+}
+
+// How many bytes from byte number off of the stream can be
+// copied in one go: at most n, at most avail, and not past
+// the end of the page holding off.
+static int
+pipechunk(uint off, uint avail, int n)
+{
+  uint m = PGSIZE - off % PGSIZE;
+
+  if(m > avail)
+    m = avail;
+  if(m > n)
+    m = n;
+  return m;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +66,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi->page, 0, sizeof(pi->page));
+  for(int i = 0; i < NPIPEPAGE; i++){
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +90,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +111,17 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Data moves between user memory and the ring a page-sized
+// chunk at a time, rather than a byte at a time.
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +130,15 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = pipechunk(pi->nwrite, pi->nread + PIPESIZE - pi->nwrite, n - i);
+      if(copyin(pr->pagetable, pipeaddr(pi, pi->nwrite), addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -105,26 +150,139 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = pipechunk(pi->nread, pi->nwrite - pi->nread, n - i);
+    if(copyout(pr->pagetable, addr + i, pipeaddr(pi, pi->nread), m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Move up to n bytes of inode ip, starting at *off, into pi,
+// reading them from the buffer cache straight into the ring.
+// Waits for room like pipewrite(). Stops early at the end of
+// the file. Returns the number of bytes moved, or -1.
+int
+pipefromi(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  int i = 0, m, r;
+  char *dst;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(i < n){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){
+      wakeup(&pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+
+    // readi() may sleep, so fill the free part of the ring
+    // without the lock; wbusy keeps other writers out of it.
+    m = pipechunk(pi->nwrite, pi->nread + PIPESIZE - pi->nwrite, n - i);
+    dst = pipeaddr(pi, pi->nwrite);
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    ilock(ip);
+    if((r = readi(ip, 0, (uint64)dst, *off, m)) > 0)
+      *off += r;
+    iunlock(ip);
+
+    acquire(&pi->lock);
+    pi->wbusy = 0;
+    wakeup(&pi->nwrite);
+    if(r <= 0)
+      break;
+    pi->nwrite += r;
+    i += r;
+    wakeup(&pi->nread);
+    if(r < m)
+      break;
+  }
+  wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
+// Move up to n bytes out of pi into inode ip, starting at
+// *off, writing them from the ring straight into the buffer
+// cache. Waits for data like piperead(). Returns the number
+// of bytes moved, or -1.
+int
+pipetoi(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  // as in filewrite(), keep each transaction small enough.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, m, r, err = 0;
+  char *src;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){
+    if(killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += r){
+    m = pipechunk(pi->nread, pi->nwrite - pi->nread, n - i);
+    if(m > max)
+      m = max;
+
+    // writei() may sleep, so copy out of the ring without
+    // the lock; rbusy keeps other readers from consuming it.
+    src = pipeaddr(pi, pi->nread);
+    pi->rbusy = 1;
+    release(&pi->lock);
+
+    begin_op();
+    ilock(ip);
+    if((r = writei(ip, 0, (uint64)src, *off, m)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_op();
+
+    acquire(&pi->lock);
+    pi->rbusy = 0;
+    wakeup(&pi->nread);
+    if(r <= 0){
+      err = 1;
+      break;
+    }
+    pi->nread += r;
+    wakeup(&pi->nwrite);
+    if(r < m){
+      // error from writei, e.g. out of disk blocks.
+      err = 1;
+      i += r;
+      break;
+    }
+  }
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+  // as filewrite() does, report a failed write rather than
+  // a 0 that looks like the end of the pipe.
+  if(err && i == 0)
+    return -1;
+  return i;
+}
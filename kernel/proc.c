@@ -26,6 +26,14 @@ static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
+// Processes sleeping in sleep(), hashed by channel, so
+// that wakeup() only looks at those that might match.
+// Lock order: sq->lock, then p->lock.
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -54,9 +62,14 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+      initlock(&c->rq.lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+      initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -95,6 +108,203 @@ myproc(void)
   return p;
 }
 
+// Interrupt c's hart out of wfi.
+static void
+kick(struct cpu *c)
+{
+  *(volatile uint32*)CLINT_MSIP(c - cpus) = 1;
+}
+
+// p was just queued on c. Wake c if it idles; if it is
+// running something else, wake an idle peer to steal p.
+static void
+kickfor(struct cpu *c, struct proc *p)
+{
+  struct cpu *v;
+
+  // pairs with the fence in cpuidle().
+  __sync_synchronize();
+  if(c->idle){
+    kick(c);
+    return;
+  }
+  if(c->proc == 0 || c->proc == p)
+    return;
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v->idle){
+      kick(v);
+      return;
+    }
+  }
+}
+
+// Append p to the tail of c's run queue for p's priority.
+// Caller must hold p->lock.
+static void
+runq_push(struct cpu *c, struct proc *p)
+{
+  struct runqueue *rq = &c->rq;
+
+  acquire(&rq->lock);
+  p->cpu = c - cpus;
+  p->rq_next = 0;
+  if(rq->tail[p->priority])
+    rq->tail[p->priority]->rq_next = p;
+  else
+    rq->head[p->priority] = p;
+  rq->tail[p->priority] = p;
+  rq->count++;
+  release(&rq->lock);
+
+  if(tickless)
+    kickfor(c, p);
+}
+
+// Remove and return the longest-waiting process on c's run
+// queue, from the highest non-empty priority level, or from
+// the lowest one if lowest is set. Returns 0 if c's queue
+// is empty.
+static struct proc*
+runq_pop(struct cpu *c, int lowest)
+{
+  struct runqueue *rq = &c->rq;
+  struct proc *p = 0;
+  int i, pr;
+
+  acquire(&rq->lock);
+  for(i = 0; i < NPRIORITY; i++){
+    pr = lowest ? PRIORITY_LOW - i : PRIORITY_HIGH + i;
+    if((p = rq->head[pr]) != 0){
+      rq->head[pr] = p->rq_next;
+      if(rq->head[pr] == 0)
+        rq->tail[pr] = 0;
+      p->rq_next = 0;
+      rq->count--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Called by an idle cpu c: take a process from the
+// lowest-priority queue of the peer with the most
+// queued processes. Returns 0 if every peer is idle.
+static struct proc*
+runq_steal(struct cpu *c)
+{
+  struct cpu *v, *victim = 0;
+  struct proc *p;
+
+  for(v = cpus; v < &cpus[NCPU]; v++){
+    if(v == c || !v->online || v->rq.count == 0)
+      continue;
+    if(victim == 0 || v->rq.count > victim->rq.count)
+      victim = v;
+  }
+  if(victim == 0)
+    return 0;
+
+  // victim's queue may have drained since we looked.
+  if((p = runq_pop(victim, 1)) == 0)
+    return 0;
+  __sync_fetch_and_add(&victim->nmigrate, 1);
+  c->nsteal++;
+  return p;
+}
+
+// The online cpu with the fewest queued processes, used to
+// place new processes. The counts are read without locks;
+// a stale value only makes the placement less even.
+static struct cpu*
+leastloaded(void)
+{
+  struct cpu *c, *best = 0;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(!c->online)
+      continue;
+    if(best == 0 || c->rq.count < best->rq.count)
+      best = c;
+  }
+  // userinit() runs before any hart has entered scheduler().
+  if(best == 0)
+    best = &cpus[0];
+  return best;
+}
+
+static struct sleepq*
+sleepqof(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
+// Put p at the head of sq. Caller must hold sq->lock.
+static void
+sleepq_push(struct sleepq *sq, struct proc *p)
+{
+  p->sq = sq;
+  p->sq_prev = 0;
+  p->sq_next = sq->head;
+  if(sq->head)
+    sq->head->sq_prev = p;
+  sq->head = p;
+}
+
+// Take p off its wait queue. Caller must hold p->sq->lock.
+static void
+sleepq_unlink(struct proc *p)
+{
+  if(p->sq_prev)
+    p->sq_prev->sq_next = p->sq_next;
+  else
+    p->sq->head = p->sq_next;
+  if(p->sq_next)
+    p->sq_next->sq_prev = p->sq_prev;
+  p->sq = 0;
+  p->sq_prev = p->sq_next = 0;
+}
+
+// Nothing for c to run. With tickless idle, wait in wfi
+// rather than spin, with the timer put off until the next
+// sleeper is due, until that or a kick from runq_push().
+static void
+cpuidle(struct cpu *c)
+{
+  struct cpu *v;
+
+  if(!tickless)
+    return;
+
+  intr_off();
+  c->idle = 1;
+  // a peer may have queued work since runq_steal() looked,
+  // before it could see c->idle.
+  __sync_synchronize();
+  for(v = cpus; v < &cpus[NCPU]; v++)
+    if(v->online && v->rq.count > 0)
+      break;
+  if(v == &cpus[NCPU]){
+    c->nidle++;
+    timeridle();
+    // a pending interrupt ends wfi even with intr_off().
+    asm volatile("wfi");
+    timerarm();
+  }
+  c->idle = 0;
+}
+
+// Make p RUNNABLE and queue it on c.
+// Caller must hold p->lock. Reads ticks without
+// tickslock, since timertick() holds it.
+static void
+setrunnable(struct proc *p, struct cpu *c)
+{
+  p->state = RUNNABLE;
+  p->waiting_since = ticks;
+  runq_push(c, p);
+}
+
 int
 allocpid()
 {
@@ -168,6 +378,7 @@ freeproc(struct proc *p)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  p->nseg = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -255,7 +466,7 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p, leastloaded());
 
   release(&p->lock);
 }
@@ -270,9 +481,11 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    // Only reserve the address space; usertrap() and
+    // copyin()/copyout() allocate pages on first touch.
+    if(sz + n > TRAPFRAME)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -319,6 +532,14 @@ fork(void)
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
+  // share the executable for demand paging.
+  if(p->execip){
+    np->execip = idup(p->execip);
+    idenywrite(np->execip);
+  }
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
+
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -330,11 +551,10 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
   np->priority = PRIORITY_HIGH;
   np->created_at = uptime();
-  np->waiting_since = uptime();
   np->running_time = 0;
+  setrunnable(np, leastloaded());
   release(&np->lock);
 
   // printf("Pid : %d forked\n", pid);
@@ -378,8 +598,13 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->execip){
+    iallowwrite(p->execip);
+    iput(p->execip);
+  }
   end_op();
   p->cwd = 0;
+  p->execip = 0;
 
   acquire(&wait_lock);
 
@@ -410,6 +635,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // the copyout below happens while holding spinlocks.
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
@@ -464,56 +693,48 @@ scheduler(void)
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    struct  proc * priority_process = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-
-        if (p->state == RUNNABLE &&
-            (!priority_process ||
-             priority_process->priority > p->priority ||
-             priority_process->waiting_since > p->waiting_since)) {
-            priority_process = p;
-        }
+    if((p = runq_pop(c, 0)) == 0 && (p = runq_steal(c)) == 0){
+      cpuidle(c);
+      continue;
     }
 
-    for (p = proc; p < &proc[NPROC]; p++)
-        if (p != priority_process)
-            release(&p->lock);
-
-      if (priority_process != 0) {
-          // Switch to chosen process.  It is the process's job
-          // to release its lock and then reacquire it
-          // before jumping back to us.
-
-//          printf("The process with id of %d  and priority of %d is switched with cpu (Scheduler)!\n",
-//                 priority_process->pid, priority_process->priority);
-
-          priority_process->state = RUNNING;
-          priority_process->running_since = uptime();
+    // p is off every queue, so nobody else will run it, but
+    // the cpu that queued it may still be switching away
+    // from it; acquire() waits for that to finish.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: queued process not runnable");
 
-          c->proc = priority_process;
-          swtch(&c->context, &priority_process->context);
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->running_since = uptime();
+    p->cpu = c - cpus;
 
-          priority_process->priority = (priority_process->priority + 1 < PRIORITY_LOW ?
-                                        priority_process->priority + 1 : PRIORITY_LOW);
+    c->proc = p;
+    c->nswitch++;
+    swtch(&c->context, &p->context);
 
-//          printf("The process was running for %d\n", uptime() - priority_process->running_since);
-//
-//          printf("The process with id of %d  and priority of %d is yield)!\n",
-//                 priority_process->pid, priority_process->priority);
+    p->priority = (p->priority + 1 < PRIORITY_LOW ?
+                   p->priority + 1 : PRIORITY_LOW);
 
-          priority_process->running_time += uptime() - priority_process->running_since + 1;
+    p->running_time += uptime() - p->running_since + 1;
 
-          // Process is done running for now.
-          // It should have changed its p->state before coming back.
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // yield() leaves it RUNNABLE; requeue it here, now that
+    // its priority has been lowered.
+    if(p->state == RUNNABLE)
+      runq_push(c, p);
 
-          c->proc = 0;
-          release(&priority_process->lock);
-      }
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -586,28 +807,38 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = sleepqof(chan);
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold sq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks sq->lock, then p->lock),
   // so it's okay to release lk.
 
+  acquire(&sq->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  sleepq_push(sq, p);
+  release(&sq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took p off the queue, unless kill() woke it.
+  acquire(&sq->lock);
+  if(p->sq)
+    sleepq_unlink(p);
+  release(&sq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -616,17 +847,22 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *sq = sleepqof(chan);
+  struct proc *p, *next;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+  acquire(&sq->lock);
+  for(p = sq->head; p; p = next) {
+    next = p->sq_next;
+    acquire(&p->lock);
+    // p may share the bucket, or be awake already
+    // and not yet off the queue.
+    if(p->state == SLEEPING && p->chan == chan) {
+      sleepq_unlink(p);
+      setrunnable(p, &cpus[p->cpu]);
     }
+    release(&p->lock);
   }
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -643,7 +879,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p, &cpus[p->cpu]);
       }
       release(&p->lock);
       return 0;
@@ -777,7 +1013,7 @@ uptime(void)
 int
 top(struct top * t)
 {
-    if ((uptime() - top_disabled_at) / 10 < 3)
+    if (uptime() - top_disabled_at < 3 * (MTIMEFREQ / tickinterval))
     {
         t->stop = 1;
         return 0;
@@ -828,14 +1064,37 @@ top(struct top * t)
 
         // Calculate memory usage percentage
         currentInfo->mem_usage_percentage = (currentProcess->mem_usage * 100.0) / total_memory;
+
+        // p->lock keeps exec() and wait() from freeing the page table.
+        int shared = 0, private = 0;
+        acquire(&currentProcess->lock);
+        if (currentProcess->pagetable)
+            uvmusage(currentProcess->pagetable, currentProcess->sz, &shared, &private);
+        release(&currentProcess->lock);
+        currentInfo->shared_memory = shared * PGSIZE / 1024;
+        currentInfo->private_memory = private * PGSIZE / 1024;
+    }
+
+    for(int i = 0; i < NCPU; i++) {
+        struct cpu_info *currentInfo = &(t->c_list[i]);
+
+        currentInfo->online = cpus[i].online;
+        currentInfo->switches = cpus[i].nswitch;
+        currentInfo->steals = cpus[i].nsteal;
+        currentInfo->migrations = cpus[i].nmigrate;
+        currentInfo->timerintrs = cpus[i].ntimer;
+        currentInfo->idles = cpus[i].nidle;
     }
 
     t->running_process = numberOfRunningProcesses;
     t->sleeping_process = numberOfSleepingProcesses;
     t->total_process = totalNumberOfProcesses;
     t->total_memory = total_memory;
+    t->hz = MTIMEFREQ / tickinterval;
+    t->tickless = tickless;
     t->free_memory = free_memory;
     t->used_memory = used_memory;
+    kmemstats(&t->kmem_acquires, &t->kmem_contended);
 
     return 0;
 }
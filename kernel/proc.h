@@ -18,12 +18,31 @@ struct context {
   uint64 s11;
 };
 
+#define NPRIORITY 3  // number of Priority levels
+
+// Per-CPU queue of RUNNABLE processes, one FIFO
+// list per Priority level.
+struct runqueue {
+  struct spinlock lock;
+  struct proc *head[NPRIORITY];
+  struct proc *tail[NPRIORITY];
+  int count;                  // Number of queued processes.
+};
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int online;                 // Has this cpu entered scheduler()?
+  struct runqueue rq;         // Processes waiting to run on this cpu.
+  uint nswitch;               // Processes run by this cpu.
+  uint nsteal;                // Processes this cpu stole from a peer.
+  uint nmigrate;              // Processes peers stole from this cpu.
+  uint ntimer;                // Timer interrupts and kicks taken.
+  uint nidle;                 // Times this cpu waited in wfi.
+  int idle;                   // Waiting in wfi for a kick or deadline?
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +98,16 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A program segment that exec() left to be read in
+// from the executable, a page at a time, on first touch.
+struct execseg {
+  uint64 va;                   // Page-aligned start address
+  uint64 memsz;                // Size in memory
+  uint off;                    // Offset in the executable
+  uint filesz;                 // Bytes backed by the file; the rest is zero
+  int perm;                    // PTE_X and/or PTE_W
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -89,6 +118,11 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // Index of the cpu whose run queue p is on
+  struct proc *rq_next;        // Next in run queue; protected by rq.lock
+  struct sleepq *sq;           // Wait queue p is on; protected by sq->lock
+  struct proc *sq_prev;        // Neighbours on that queue
+  struct proc *sq_next;
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -107,5 +141,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Executable, for demand paging
+  struct execseg seg[NEXECSEG]; // Segments not read in at exec()
+  int nseg;                    // Number of valid entries in seg
+  int ilocks;                  // Inode locks held, see vmfault()
   char name[16];               // Process name (debugging)
 };
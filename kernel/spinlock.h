@@ -5,5 +5,7 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  uint nacquire;     // Number of acquire() calls.
+  uint ncontend;     // Of those, how many had to spin.
 };
 
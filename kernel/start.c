@@ -5,20 +5,27 @@
 #include "defs.h"
 
 void main();
-void timerinit();
+void timerinit(uint64);
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][6];
+
+// mtime cycles per clock tick, and whether idle harts
+// stop their tick; set from the kernel command line.
+uint64 tickinterval;
+int tickless;
+static volatile int bootargsdone;
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
-// entry.S jumps here in machine mode on stack0.
+// entry.S jumps here in machine mode on stack0,
+// with the device tree address from qemu in dtb.
 void
-start()
+start(uint64 hartid, uint64 dtb)
 {
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
@@ -44,7 +51,7 @@ start()
   w_pmpcfg0(0xf);
 
   // ask for clock interrupts.
-  timerinit();
+  timerinit(dtb);
 
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
@@ -60,22 +67,41 @@ start()
 // which turns them into software interrupts for
 // devintr() in trap.c.
 void
-timerinit()
+timerinit(uint64 dtb)
 {
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
+  // hart 0 reads the settings, e.g. from qemu -append
+  // "hz=100 tickless=0", before kinit() can free the pages
+  // the device tree is in; the others wait for them.
+  if(id == 0){
+    int hz = bootarg(dtb, "hz", TICKHZ);
+    if(hz <= 0 || hz > MTIMEFREQ)
+      hz = TICKHZ;
+    tickinterval = MTIMEFREQ / hz;
+    tickless = bootarg(dtb, "tickless", TICKLESS);
+    __sync_synchronize();
+    bootargsdone = 1;
+  } else {
+    while(bootargsdone == 0)
+      ;
+    __sync_synchronize();
+  }
+
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  uint64 interval = tickinterval; // cycles
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
   // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : address of CLINT MSIP register, to clear a kick.
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
   scratch[4] = interval;
+  scratch[5] = CLINT_MSIP(id);
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +110,7 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and software
+  // interrupts, which other harts use to kick an idle one.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -103,6 +103,8 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_history(void);
 extern uint64 sys_top(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_nanosleep(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -130,6 +132,8 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_history] sys_history,
 [SYS_top] sys_top,
+[SYS_splice] sys_splice,
+[SYS_nanosleep] sys_nanosleep,
 };
 
 void
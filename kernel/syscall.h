@@ -21,4 +21,6 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_history 22
-#define SYS_top 23
\ No newline at end of file
+#define SYS_top 23
+#define SYS_splice 24
+#define SYS_nanosleep 25
\ No newline at end of file
@@ -94,6 +94,19 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// move bytes between a file and a pipe inside the kernel.
+uint64
+sys_splice(void)
+{
+  struct file *fin, *fout;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &fin) < 0 || argfd(1, 0, &fout) < 0)
+    return -1;
+  return filesplice(fin, fout, n);
+}
+
 uint64
 sys_close(void)
 {
@@ -222,6 +235,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -268,7 +282,8 @@ create(char *path, short type, short major, short minor)
   }
 
   ilock(ip);
-  ip->major = major;
+  // new directories use hash chains; see fs.h.
+  ip->major = type == T_DIR ? DIRHASHED : major;
   ip->minor = minor;
   ip->nlink = 1;
   iupdate(ip);
@@ -341,6 +356,13 @@ sys_open(void)
     return -1;
   }
 
+  // itrunc() would pull pages out from under a running program.
+  if((omode & O_TRUNC) && ip->denywrite){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -355,6 +377,8 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->raend = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
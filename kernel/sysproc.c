@@ -53,20 +53,24 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n < 0)
+    n = 0;
+  return tsleep(n);
+}
+
+// sleep for at least ns nanoseconds, timed by the CLINT's
+// mtime rather than by counting ticks, and woken by a timer
+// interrupt set for the deadline.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+  uint64 per = 1000000000 / MTIMEFREQ;
+
+  argaddr(0, &ns);
+  return hrsleep(mtime() + (ns + per - 1) / per);
 }
 
 uint64
@@ -100,16 +104,25 @@ uint64
 sys_top(void)
 {
     struct top *currentTop;
-    struct top kCurrentTop;
+    struct top *kCurrentTop;
+
+    // struct top is too big for the one-page kernel stack,
+    // but fits in a page of its own.
+    _Static_assert(sizeof (struct top) <= PGSIZE, "sys_top: struct top");
+    if ((kCurrentTop = (struct top *) kalloc()) == 0)
+        return -1;
+    // top() fills in only the slots of live processes.
+    memset(kCurrentTop, 0, sizeof (*kCurrentTop));
 
     argaddr(0, (uint64 *) &currentTop);
     struct proc *p = myproc();
-    copyin(p->pagetable, (char*) currentTop, (uint64) &kCurrentTop, sizeof (kCurrentTop));
 
-    kCurrentTop.uptime = sys_uptime();
-    int err = top(&kCurrentTop);
+    kCurrentTop->uptime = sys_uptime();
+    int err = top(kCurrentTop);
 
-    copyout(p->pagetable, (uint64) currentTop, (char*) &kCurrentTop, sizeof (kCurrentTop));
+    if (copyout(p->pagetable, (uint64) currentTop, (char*) kCurrentTop, sizeof (*kCurrentTop)) < 0)
+        err = -1;
+    kfree(kCurrentTop);
 
     return err;
 }
\ No newline at end of file
@@ -0,0 +1,259 @@
+// Timer wheel of sleeping processes' deadlines, so that a
+// clock tick only wakes the processes whose time has come.
+//
+// Level l has NTWSLOT slots, each NTWSLOT^l ticks wide. A timer
+// goes in the lowest level whose range reaches its deadline,
+// and is moved down a level when its slot comes round, until
+// it reaches level 0 and fires on its exact tick.
+//
+// tickslock protects the wheel; ticks is its current time.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define TWBITS   6
+#define NTWSLOT  (1 << TWBITS)
+#define NTWLEVEL 4
+#define TWRANGE  (1U << (TWBITS*NTWLEVEL))  // ticks the wheel reaches
+
+struct timer {
+  uint expires;         // tick to wake up at
+  int fired;
+  struct timer *next;
+  struct timer **pprev; // pointer to this, in slot or previous timer
+};
+
+static struct timer *wheel[NTWLEVEL][NTWSLOT];
+
+// nanosleep()s, which wake at an mtime deadline between ticks
+// rather than on a tick: a list sorted by deadline, also under
+// tickslock. hrnext is the first deadline, for timerarm()
+// and clockintr() to read without the lock.
+struct hrtimer {
+  uint64 when;          // mtime to wake up at
+  int fired;
+  struct hrtimer *next;
+};
+
+static struct hrtimer *hrq;
+volatile uint64 hrnext = ~0UL;
+
+// Put t in the slot that comes round at or before t->expires.
+// Caller must hold tickslock.
+static void
+twadd(struct timer *t)
+{
+  uint d = t->expires - ticks;
+  uint e = t->expires;
+  struct timer **s;
+  int l;
+
+  // beyond the top level, park it in the farthest slot;
+  // it is placed again when that slot comes round.
+  if(d >= TWRANGE){
+    d = TWRANGE - 1;
+    e = ticks + d;
+  }
+  for(l = 0; l < NTWLEVEL-1 && d >= (1U << (TWBITS*(l+1))); l++)
+    ;
+  s = &wheel[l][(e >> (TWBITS*l)) & (NTWSLOT-1)];
+  t->next = *s;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = s;
+  *s = t;
+}
+
+// Caller must hold tickslock.
+static void
+twdel(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Empty slot *s, returning its list. tickslock stays held
+// until each timer is placed again or fired.
+static struct timer*
+twtake(struct timer **s)
+{
+  struct timer *t = *s;
+
+  *s = 0;
+  return t;
+}
+
+// Called by clockintr() after advancing ticks, holding
+// tickslock: move timers down from the higher levels whose
+// slots have come round, then wake the ones due now.
+void
+timertick(void)
+{
+  struct timer *t, *next;
+  int l;
+
+  for(l = 1; l < NTWLEVEL; l++){
+    if(ticks & ((1U << (TWBITS*l)) - 1))
+      break;
+    for(t = twtake(&wheel[l][(ticks >> (TWBITS*l)) & (NTWSLOT-1)]); t; t = next){
+      next = t->next;
+      twadd(t);
+    }
+  }
+
+  for(t = twtake(&wheel[0][ticks & (NTWSLOT-1)]); t; t = next){
+    next = t->next;
+    t->next = 0;
+    t->pprev = 0;
+    t->fired = 1;
+    wakeup(t);
+  }
+}
+
+// Ticks from now until timertick() next has a slot to
+// empty, or TWRANGE if the wheel is empty.
+// Caller must hold tickslock.
+static uint
+twnext(void)
+{
+  uint best = TWRANGE, w, t;
+  int l, i;
+
+  for(l = 0; l < NTWLEVEL; l++){
+    w = 1U << (TWBITS*l);  // ticks per slot at level l
+    t = (ticks & ~(w-1)) + w;
+    for(i = 0; i < NTWSLOT && t - ticks < best; i++, t += w){
+      if(wheel[l][(t >> (TWBITS*l)) & (NTWSLOT-1)]){
+        best = t - ticks;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+// Set this hart's timer for the next tick, or for the next
+// nanosleep() deadline if that comes first. Each timer
+// interrupt and each hart leaving idle calls this.
+void
+timerarm(void)
+{
+  uint64 when = (mtime() / tickinterval + 1) * tickinterval;
+
+  push_off();
+  if(hrnext < when)
+    when = hrnext;
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+  pop_off();
+}
+
+// An idle hart with interrupts off, about to wfi: set its
+// timer for the wheel's next deadline instead of the next
+// tick. clockintr() makes up the ticks it sleeps through.
+void
+timeridle(void)
+{
+  uint64 when;
+
+  acquire(&tickslock);
+  when = (tickbase + ticks + twnext()) * tickinterval;
+  if(hrnext < when)
+    when = hrnext;
+  release(&tickslock);
+  *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Called by clockintr() holding tickslock: wake the
+// nanosleep()s whose deadlines have passed.
+void
+hrtick(void)
+{
+  uint64 now = mtime();
+
+  while(hrq && hrq->when <= now){
+    hrq->fired = 1;
+    wakeup(hrq);
+    hrq = hrq->next;
+  }
+  hrnext = hrq ? hrq->when : ~0UL;
+}
+
+// Sleep until mtime reaches when, woken by a timer
+// interrupt set for that moment rather than by a tick.
+// Returns -1 if killed first.
+int
+hrsleep(uint64 when)
+{
+  struct proc *p = myproc();
+  struct hrtimer t, **pp;
+  int r = 0;
+
+  acquire(&tickslock);
+  t.when = when;
+  t.fired = 0;
+  for(pp = &hrq; *pp && (*pp)->when <= when; pp = &(*pp)->next)
+    ;
+  t.next = *pp;
+  *pp = &t;
+  hrnext = hrq->when;
+  // this hart's timer goes off in time for it; a deadline
+  // already past fires at once.
+  timerarm();
+  while(!t.fired){
+    if(killed(p)){
+      for(pp = &hrq; *pp != &t; pp = &(*pp)->next)
+        ;
+      *pp = t.next;
+      hrnext = hrq ? hrq->when : ~0UL;
+      r = -1;
+      break;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return r;
+}
+
+// Sleep for n clock ticks.
+// Returns -1 if killed before they have passed.
+int
+tsleep(uint n)
+{
+  struct proc *p = myproc();
+  struct timer t;
+  int r = 0;
+
+  if(n == 0)
+    return 0;
+
+  acquire(&tickslock);
+  t.expires = ticks + n;
+  t.fired = 0;
+  twadd(&t);
+  while(!t.fired){
+    if(killed(p)){
+      twdel(&t);
+      r = -1;
+      break;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return r;
+}
+
+// Read the CLINT's free-running counter, which counts
+// MTIMEFREQ times a second.
+uint64
+mtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
@@ -8,10 +8,23 @@ struct proc_info{
     int ppid;
     enum procstate state;
     float mem_usage_percentage; // Add this field
+    int shared_memory;  // KB mapped from pages shared with others
+    int private_memory; // KB mapped from pages only this process uses
+};
+
+struct cpu_info{
+    int online;
+    uint switches;   // processes run on this cpu
+    uint steals;     // processes it took from other cpus
+    uint migrations; // processes other cpus took from it
+    uint timerintrs; // timer interrupts and kicks it took
+    uint idles;      // times it waited in wfi
 };
 
 struct top{
     long uptime;
+    int hz;          // clock ticks per second
+    int tickless;    // do idle cpus stop ticking?
     int total_process;
     int running_process;
     int sleeping_process;
@@ -19,5 +32,8 @@ struct top{
     int total_memory; // Add this field
     int used_memory;  // Add this field
     int free_memory;  // Add this field
+    uint kmem_acquires;  // kmem.lock acquisitions
+    uint kmem_contended; // of which had to spin
     struct proc_info p_list[NPROC];
+    struct cpu_info c_list[NCPU];
 };
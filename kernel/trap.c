@@ -8,6 +8,7 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint64 tickbase;  // mtime() / tickinterval when ticks was 0
 
 extern char trampoline[], uservec[], userret[];
 
@@ -20,6 +21,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  tickbase = mtime() / tickinterval;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -67,23 +69,18 @@ usertrap(void)
         syscall();
     } else if((which_dev = devintr()) != 0){
         // ok
-    } else if (r_scause() == 15) { // Page fault
+    } else if (r_scause() == 12 || r_scause() == 13 || r_scause() == 15) { // Page fault
+        uint64 scause = r_scause();
         uint64 va = r_stval();
-        pte_t *pte = walk(p->pagetable, va, 0);
-
-        if (pte && (*pte & PTE_V) && (*pte & PTE_U) && !(*pte & PTE_W) && (*pte & PTE_COW)) {
-            // Page fault due to write access on a COW page
-            char *mem = kalloc();
-            if(mem == 0){
-                setkilled(p);
-            } else {
-                uint64 pa = PTE2PA(*pte);
-                memmove(mem, (char*)pa, PGSIZE);
-                *pte = PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W;
-                *pte &= ~PTE_COW;
-                kfree((void*)pa);
-            }
-        } else {
+
+        // reading in a program page may sleep, and interrupts
+        // change scause, so only enable them now.
+        intr_on();
+
+        // Either a write to a COW page, or the first touch of
+        // a program page or a heap page that sbrk() reserved.
+        if ((scause != 15 || cowfault(p->pagetable, va, p->sz) < 0) &&
+            vmfault(p->pagetable, va) == 0) {
             printf("usertrap(): unexpected page fault at va=%p pid=%d\n", va, p->pid);
             setkilled(p);
         }
@@ -180,13 +177,29 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+// Bring ticks up to the time mtime says it is, running the
+// timer wheel for each tick passed, and wake nanosleep()s
+// that are due. Every hart's timer interrupt calls this, so
+// time keeps up whichever harts are idle, and a hart that
+// slept through ticks catches up.
 void
 clockintr()
 {
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
+  uint now = mtime() / tickinterval - tickbase;
+
+  // usually another hart has counted this tick already.
+  if(now != ticks || hrnext <= mtime()){
+    acquire(&tickslock);
+    while((int)(now - ticks) > 0){
+      ticks++;
+      timertick();
+    }
+    hrtick();
+    release(&tickslock);
+  }
+
+  // timervec only added an interval; aim at the next event.
+  timerarm();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -225,10 +238,9 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
+    mycpu()->ntimer++;
+    clockintr();
+
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
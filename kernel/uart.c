@@ -33,14 +33,14 @@
 #define LCR_BAUD_LATCH (1<<7) // special mode to set baud rate
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
-#define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define LSR_TX_IDLE (1<<5)    // THR and the transmit FIFO are empty
+#define TX_FIFO_SIZE 16       // bytes the transmit FIFO holds
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,34 +77,58 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
-// UART to start sending if it isn't already.
-// blocks if the output buffer is full.
-// because it may block, it can't be called
-// from interrupts; it's only suitable for use
-// by write().
-void
-uartputc(int c)
+// copy n bytes from src into the output buffer, and tell
+// the UART to start sending if it isn't already. blocks
+// while the output buffer is full.
+// src is copied a chunk at a time into a buffer on the
+// stack before uart_tx_lock is taken, so that a page fault
+// on a user src is never taken with the lock held; the
+// chunk then goes into the output buffer as space allows.
+// because it may block, it can't be called from interrupts;
+// it's only suitable for use by write().
+// returns the number of bytes copied, or -1 if none could be.
+int
+uartwrite(int user_src, uint64 src, int n)
 {
-  acquire(&uart_tx_lock);
-
-  if(panicked){
-    for(;;)
-      ;
-  }
-  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+  char chunk[128];
+  int i, j, c, m;
+  uint64 off;
+
+  for(i = 0; i < n; i += c){
+    c = n - i;
+    if(c > sizeof(chunk))
+      c = sizeof(chunk);
+    if(either_copyin(chunk, user_src, src + i, c) == -1)
+      return i > 0 ? i : -1;
+
+    acquire(&uart_tx_lock);
+    if(panicked){
+      for(;;)
+        ;
+    }
+    for(j = 0; j < c; j += m){
+      while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+        // buffer is full.
+        // wait for uartstart() to open up space in the buffer.
+        sleep(&uart_tx_r, &uart_tx_lock);
+      }
+      // as much as fits before the buffer wraps.
+      off = uart_tx_w % UART_TX_BUF_SIZE;
+      m = UART_TX_BUF_SIZE - off;
+      if(m > uart_tx_r + UART_TX_BUF_SIZE - uart_tx_w)
+        m = uart_tx_r + UART_TX_BUF_SIZE - uart_tx_w;
+      if(m > c - j)
+        m = c - j;
+      memmove(&uart_tx_buf[off], chunk + j, m);
+      uart_tx_w += m;
+      uartstart();
+    }
+    release(&uart_tx_lock);
   }
-  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-  uart_tx_w += 1;
-  uartstart();
-  release(&uart_tx_lock);
+  return i;
 }
 
-
-// alternate version of uartputc() that doesn't 
+// alternate version of uartwrite() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
 // output register to be empty.
@@ -126,34 +150,33 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, refill its FIFO from them.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART is still sending what it was given;
+    // it will interrupt when its FIFO has drained.
+    return;
+  }
+
+  for(i = 0; i < TX_FIFO_SIZE && uart_tx_r != uart_tx_w; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
@@ -48,6 +48,7 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;    // no one waits; virtio_disk_intr() finishes it
   } info[NUM];
 
   // disk command headers.
@@ -212,26 +213,15 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// format the three descriptors in idx for a transfer of b,
+// and put the chain on the avail ring. the device won't look
+// at it until notify().
+// caller must hold disk.vdisk_lock.
+static void
+submit(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
@@ -275,20 +265,71 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
+// ring the doorbell: the device starts on every chain
+// added to the avail ring since the last notify().
+static void
+notify(void)
+{
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+// transfer the n locked buffers in bs, notifying the device
+// once per batch rather than once per buffer. the transfers
+// may complete in any order.
+//
+// if wait is set, sleep for descriptors as needed and return
+// once every transfer has finished. otherwise start as many
+// as fit without sleeping, and let virtio_disk_intr() finish
+// each one by calling bprefetchdone(); returns how many of
+// bs, from the front, were started.
+int
+virtio_disk_rwv(struct buf **bs, int n, int write, int wait)
+{
+  int i, idx[3], pending = 0;
+
+  acquire(&disk.vdisk_lock);
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  // the spec's Section 5.2 says that legacy block operations use
+  // three descriptors: one for type/reserved/sector, one for the
+  // data, one for a 1-byte status result.
+  for(i = 0; i < n; i++){
+    while(alloc3_desc(idx) < 0){
+      if(!wait)
+        goto out;
+      // let the device work through what is queued so far,
+      // otherwise no descriptors will ever come free.
+      if(pending){
+        notify();
+        pending = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    disk.info[idx[0]].async = !wait;
+    submit(bs[i], write, idx);
+    pending++;
+  }
+out:
+  if(pending)
+    notify();
+
+  // Wait for virtio_disk_intr() to say each request has finished.
+  for(int j = 0; wait && j < n; j++){
+    while(bs[j]->disk == 1)
+      sleep(bs[j], &disk.vdisk_lock);
+  }
 
   release(&disk.vdisk_lock);
+  return i;
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write, 1);
 }
 
 void
@@ -316,9 +357,19 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
+    // requests may finish in any order, so free each chain
+    // here rather than in the process that submitted it.
     struct buf *b = disk.info[id].b;
+    int async = disk.info[id].async;
+    disk.info[id].b = 0;
+    disk.info[id].async = 0;
+    free_chain(id);
+
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(async)
+      bprefetchdone(b);  // no one is waiting for it
+    else
+      wakeup(b);
 
     disk.used_idx += 1;
   }
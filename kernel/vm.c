@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -33,6 +35,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for mtime() and for idle harts' timers and kicks
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -165,7 +170,7 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -177,10 +182,11 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    // lazily allocated heap pages may never have been touched.
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -310,10 +316,11 @@ uvmcopy(pagetable_t src, pagetable_t dst, uint64 sz)
     uint flags;
 
     for(i = 0; i < sz; i += PGSIZE){
+        // skip heap pages that haven't been touched yet.
         if((pte = walk(src, i, 0)) == 0)
-            panic("uvmcopy: pte should exist");
+            continue;
         if((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
+            continue;
         pa = PTE2PA(*pte);
         flags = PTE_FLAGS(*pte);
         if(flags & PTE_W){
@@ -332,6 +339,159 @@ uvmcopy(pagetable_t src, pagetable_t dst, uint64 sz)
     return -1;
 }
 
+// Give the copy-on-write page at va a private, writable
+// frame. If no other page table still shares the frame,
+// just make it writable again instead of copying it.
+// Returns 0 on success, -1 if va is not a COW page or
+// there is no memory for the copy.
+static int
+cowcopy(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+     (*pte & PTE_W) != 0 || (*pte & PTE_COW) == 0)
+    return -1;
+
+  pa = PTE2PA(*pte);
+  if(get_refcount((void*)pa) == 1){
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = (PA2PTE(mem) | PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Map the page at va of the current process on its first
+// touch. Program text and data are read in from the
+// executable (see exec()); anything else below p->sz is
+// heap that growproc() only reserved, and gets a zeroed
+// page. Returns the page's physical address, or 0 if va
+// isn't such a page or memory ran out.
+// Reading a program page sleeps, and may need the inode
+// lock of the executable, so it fails instead if the caller
+// holds a spinlock (interrupts are off) or an inode lock:
+// copyin()/copyout() inside pipe, console and file code.
+uint64
+vmfault(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct execseg *s;
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(p == 0 || pagetable != p->pagetable || va >= p->sz)
+    return 0;
+  // already mapped, e.g. the stack guard page.
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return 0;
+
+  if((s = findseg(p, va)) != 0){
+    if(!intr_get() || p->ilocks > 0)
+      return 0;
+    return loadpage(p, s, va);
+  }
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return 0;
+  }
+  return (uint64)mem;
+}
+
+// Like walkaddr(), but first maps va if it is a
+// not-yet-touched page of the current process,
+// for copyin() and copyout().
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va)
+{
+  uint64 pa;
+
+  if((pa = walkaddr(pagetable, va)) == 0)
+    pa = vmfault(pagetable, va);
+  return pa;
+}
+
+// Read in any not-yet-loaded program pages in [va, va+len)
+// of the current process. vmfault() won't once a lock is
+// held, so code that copies to or from user memory holding
+// a spinlock or an inode lock calls this first; if it fails,
+// the copy fails too.
+void
+uvmprefault(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len && a < p->sz; a += PGSIZE){
+    if(walkaddr(p->pagetable, a) == 0 && findseg(p, a) != 0)
+      vmfault(p->pagetable, a);
+  }
+}
+
+// Resolve a write fault at va on a copy-on-write page.
+// A process that writes through its memory after fork()
+// would fault on the next pages too, so also resolve up
+// to NCOWAROUND following COW pages below sz in the same
+// trap. Returns 0 on success, -1 if the faulting page
+// could not be made writable.
+int
+cowfault(pagetable_t pagetable, uint64 va, uint64 sz)
+{
+  uint64 a;
+
+  va = PGROUNDDOWN(va);
+  if(cowcopy(pagetable, va) < 0)
+    return -1;
+
+  for(a = va + PGSIZE; a < sz && a <= va + NCOWAROUND*PGSIZE; a += PGSIZE){
+    if(cowcopy(pagetable, a) < 0)
+      break;
+  }
+  return 0;
+}
+
+// Count the user pages below sz that pagetable shares with
+// other page tables or the program page cache, and those
+// that are private to it.
+void
+uvmusage(pagetable_t pagetable, uint64 sz, int *shared, int *private)
+{
+  uint64 va;
+  pte_t *pte;
+
+  *shared = 0;
+  *private = 0;
+  for(va = 0; va < sz; va += PGSIZE){
+    if((pte = walk(pagetable, va, 0)) == 0){
+      // no page-table page; skip to the next one.
+      va = PGROUNDDOWN(va | ((1L << PXSHIFT(1)) - 1));
+      continue;
+    }
+    if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+      continue;
+    // a reference held by the program page cache
+    // doesn't make the page shared.
+    if(get_refcount((void*)PTE2PA(*pte)) - pcacheholds(PTE2PA(*pte)) > 1)
+      (*shared)++;
+    else
+      (*private)++;
+  }
+}
 
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
@@ -353,12 +513,20 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
+    // break copy-on-write sharing before the kernel writes.
+    pte = walk(pagetable, va0, 0);
+    if((*pte & PTE_W) == 0){
+      if(cowcopy(pagetable, va0) < 0)
+        return -1;
+      pa0 = PTE2PA(*pte);
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -381,7 +549,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -408,7 +576,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -20,9 +20,11 @@
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int fssize = FSSIZE;   // -s: size of file system in blocks
+int ninodes = NINODES; // -i: number of inodes
+int nlog = MAXOPBLOCKS*3; // -l: log blocks, including the header
+int nbitmap;
+int ninodeblocks;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -41,6 +43,13 @@ void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void die(const char *);
+void rootlink(char *name, uint inum);
+
+// The root directory is built here, in the hashed format
+// (see kernel/fs.h), and written out at the end.
+#define ROOTBLOCKS 256
+char rootdir[ROOTBLOCKS][BSIZE];
+int nrootblocks = 1;
 
 // convert to riscv byte order
 ushort
@@ -69,7 +78,7 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
+  uint rootino, inum;
   struct dirent de;
   char buf[BSIZE];
   struct dinode din;
@@ -77,10 +86,42 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while((i = getopt(argc, argv, "s:l:i:")) != -1){
+    switch(i){
+    case 's':
+      fssize = atoi(optarg);
+      break;
+    case 'l':
+      nlog = atoi(optarg);
+      break;
+    case 'i':
+      ninodes = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+usage:
+    fprintf(stderr, "Usage: mkfs [-s fsblocks] [-l logblocks] [-i ninodes] fs.img files...\n");
+    exit(1);
+  }
+
+  // the kernel needs room for one maximal FS op, and can't
+  // use more than LOGSIZE blocks plus the header.
+  if(nlog < MAXOPBLOCKS+1 || nlog > LOGSIZE+1){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n", MAXOPBLOCKS+1, LOGSIZE+1);
+    exit(1);
+  }
+  if(ninodes < 2){
+    fprintf(stderr, "mkfs: too few inodes\n");
     exit(1);
   }
+  nbitmap = fssize/(BSIZE*8) + 1;
+  ninodeblocks = ninodes / IPB + 1;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
@@ -91,23 +132,27 @@ main(int argc, char *argv[])
 
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
+  if(nblocks <= 0){
+    fprintf(stderr, "mkfs: file system too small\n");
+    exit(1);
+  }
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -117,15 +162,13 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
+  // "." and ".." start block 0.
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
   strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
+  memmove(rootdir[0], &de, sizeof(de));
   strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  memmove(rootdir[0] + sizeof(de), &de, sizeof(de));
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -148,11 +191,7 @@ main(int argc, char *argv[])
       shortname += 1;
 
     inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    rootlink(shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,11 +199,10 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // write out the root directory.
+  iappend(rootino, rootdir, nrootblocks * BSIZE);
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
+  din.major = xshort(DIRHASHED);
   winode(rootino, &din);
 
   balloc(freeblock);
@@ -249,6 +287,21 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry i of indirect block ind, allocating
+// a block for it if it is empty.
+uint
+indentry(uint ind, uint i)
+{
+  uint a[NINDIRECT];
+
+  rsect(ind, (char*)a);
+  if(a[i] == 0){
+    a[i] = xint(freeblock++);
+    wsect(ind, (char*)a);
+  }
+  return xint(a[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +309,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -270,16 +322,17 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = indentry(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = indentry(xint(din.addrs[NDIRECT+1]), (fbn - NDIRECT - NINDIRECT) / NINDIRECT);
+      x = indentry(x, (fbn - NDIRECT - NINDIRECT) % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -293,6 +346,38 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Add (name, inum) to the root directory, in the first free
+// slot of name's hash chain, as the kernel's dirhlink() does.
+void
+rootlink(char *name, uint inum)
+{
+  struct dirent *de;
+  struct dirhead *dh;
+  uint h = dirhash(name);
+  uint *next = &((struct dirhead*)rootdir[0] + 2 + h/3)->fbn[h%3];
+  int i;
+
+  while(*next != 0){
+    de = (struct dirent*)rootdir[xint(*next)];
+    for(i = 0; i < DPB-1; i++){
+      if(de[i].inum == 0)
+        goto found;
+    }
+    dh = (struct dirhead*)de + DPB-1;
+    next = &dh->fbn[0];
+  }
+
+  // name's chain is full, or empty; start a new block.
+  assert(nrootblocks < ROOTBLOCKS);
+  *next = xint(nrootblocks++);
+  de = (struct dirent*)rootdir[xint(*next)];
+  i = 0;
+
+found:
+  de[i].inum = xshort(inum);
+  strncpy(de[i].name, name, DIRSIZ);
+}
+
 void
 die(const char *s)
 {
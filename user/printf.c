@@ -1,5 +1,6 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 #include <stdarg.h>
@@ -8,12 +9,132 @@ static char digits[] = "0123456789ABCDEF";
 int print_size;
 int lock = 0;
 
+#define OUTBUFSIZE 1024
+
+// Output waiting to be written, per fd. The console is
+// written at the end of each printf() or fwrite() call;
+// files and pipes only when OUTBUFSIZE bytes have built
+// up, or at fflush(), close(), fork(), exec() or exit(),
+// or before a write() straight to the fd.
+enum outmode { OUT_UNKNOWN, OUT_UNBUF, OUT_CONSOLE, OUT_FULL };
+
+static struct outbuf {
+  enum outmode mode;
+  int n;
+  char *buf;
+} out[NOFILE];
+
+extern void (*stdioflush)(int, int);
+int _write(int, const void*, int);
+
+// Write out what fd has buffered.
+void
+fflush(int fd)
+{
+  struct outbuf *o;
+
+  if(fd < 0 || fd >= NOFILE)
+    return;
+  o = &out[fd];
+  if(o->n > 0)
+    _write(fd, o->buf, o->n);
+  o->n = 0;
+}
+
+// Called by ulib.c's wrappers: flush every fd, or flush
+// fd, forgetting what kind of file it was if it is closing.
+static void
+flushout(int fd, int closing)
+{
+  if(fd >= 0){
+    fflush(fd);
+    if(closing && fd < NOFILE)
+      out[fd].mode = OUT_UNKNOWN;
+    return;
+  }
+  for(fd = 0; fd < NOFILE; fd++)
+    fflush(fd);
+}
+
+// fd's buffer, or 0 if writes to fd go straight out.
+static struct outbuf*
+outbuf(int fd)
+{
+  struct outbuf *o;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  o = &out[fd];
+  if(o->mode == OUT_UNKNOWN){
+    if(o->buf == 0)
+      o->buf = malloc(OUTBUFSIZE);
+    if(o->buf == 0)
+      o->mode = OUT_UNBUF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      o->mode = OUT_CONSOLE;
+    else
+      o->mode = OUT_FULL;
+    stdioflush = flushout;
+  }
+  return o->mode == OUT_UNBUF ? 0 : o;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct outbuf *o;
+
   if (!lock)
     print_size++;
+  if((o = outbuf(fd)) == 0){
+    _write(fd, &c, 1);
+    return;
+  }
+  o->buf[o->n++] = c;
+  if(o->n == OUTBUFSIZE)
+    fflush(fd);
+}
+
+// End of a printf() or fwrite() call.
+static void
+outdone(int fd)
+{
+  struct outbuf *o = outbuf(fd);
+
+  if(o && o->mode == OUT_CONSOLE)
+    fflush(fd);
+}
+
+// Buffered write of n bytes to fd.
+int
+fwrite(int fd, const void *p, int n)
+{
+  const char *s = p;
+  struct outbuf *o;
+  int m;
+
+  if (!lock)
+    print_size += n;
+  if((o = outbuf(fd)) == 0)
+    return _write(fd, p, n);
+  // large writes to a file or pipe skip the copy.
+  if(o->mode == OUT_FULL && n >= OUTBUFSIZE){
+    fflush(fd);
+    return _write(fd, p, n);
+  }
+  while(s < (const char*)p + n){
+    m = (const char*)p + n - s;
+    if(m > OUTBUFSIZE - o->n)
+      m = OUTBUFSIZE - o->n;
+    memmove(o->buf + o->n, s, m);
+    o->n += m;
+    s += m;
+    if(o->n == OUTBUFSIZE)
+      fflush(fd);
+  }
+  outdone(fd);
+  return n;
 }
 
 void
@@ -129,6 +250,7 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  outdone(fd);
 }
 
 void
@@ -19,13 +19,24 @@ main(int argc, char *argv[])
 
         print_size = 0;
 
-        printf("uptime: %d seconds\n", currentTop.uptime / 10);
+        printf("uptime: %d seconds\n", currentTop.uptime / currentTop.hz);
         printf("total process: %d\n", currentTop.total_process);
         printf("running process: %d\n", currentTop.running_process);
         printf("sleeping process: %d\n", currentTop.sleeping_process);
         printf("Total Memory: %d KB\n", currentTop.total_memory);
         printf("Used Memory: %d KB\n", currentTop.used_memory);
         printf("Free Memory: %d KB\n", currentTop.free_memory);
+        printf("kmem lock: %d acquires, %d contended\n", currentTop.kmem_acquires, currentTop.kmem_contended);
+        printf("Clock: %d Hz, tickless idle %s\n", currentTop.hz,
+               currentTop.tickless ? "on" : "off");
+        printf("cpu    switches    steals    migrations    timer    idle\n");
+        for(int i = 0; i < NCPU; i++) {
+            if (!currentTop.c_list[i].online)
+                continue;
+            printf("%d    %d    %d    %d    %d    %d\n", i, currentTop.c_list[i].switches,
+                   currentTop.c_list[i].steals, currentTop.c_list[i].migrations,
+                   currentTop.c_list[i].timerintrs, currentTop.c_list[i].idles);
+        }
         printf("name    PID     PPID    state    mem_usage_percentage\n");
 
         for(int i = 0; i < currentTop.total_process; i++) {
@@ -58,11 +69,13 @@ main(int argc, char *argv[])
             }
 
             printf("    %f%%\n", currentTop.p_list[i].mem_usage_percentage);
-            printf("Age of the process: %d seconds\n", currentTop.p_list[i].time / 10);
+            printf("Memory: %d KB shared, %d KB private\n",
+                   currentTop.p_list[i].shared_memory, currentTop.p_list[i].private_memory);
+            printf("Age of the process: %d seconds\n", currentTop.p_list[i].time / currentTop.hz);
             printf("CPU usage of the process: %f\n", (1.0 * currentTop.p_list[i].cpu) / currentTop.uptime);
         }
 
-        sleep(10);
+        sleep(currentTop.hz);
         reset_console();
 
     } while (1);
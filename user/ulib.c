@@ -14,6 +14,58 @@ _main()
   exit(0);
 }
 
+// printf.c sets this once it holds buffered output, so that
+// it is written out before the process exits, forks or execs,
+// or before the fd is written directly or closed. fd -1 means
+// every fd; closing says fd is about to go away.
+void (*stdioflush)(int fd, int closing);
+
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(const char*, char**);
+int _close(int);
+int _write(int, const void*, int);
+
+int
+fork(void)
+{
+  if(stdioflush)
+    stdioflush(-1, 0);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdioflush)
+    stdioflush(-1, 0);
+  _exit(status);
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(stdioflush)
+    stdioflush(-1, 0);
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  if(stdioflush)
+    stdioflush(fd, 1);
+  return _close(fd);
+}
+
+int
+write(int fd, const void *p, int n)
+{
+  if(stdioflush)
+    stdioflush(fd, 0);
+  return _write(fd, p, n);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -25,6 +25,8 @@ int sleep(int);
 int uptime(void);
 int history(int);
 int top(struct top *);
+int splice(int, int, int);
+int nanosleep(uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -34,6 +36,8 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
+int fwrite(int, const void*, int);
+void fflush(int);
 extern  int print_size;
 void clean_console();
 void reset_console();
@@ -578,6 +578,8 @@ writetest(char *s)
 void
 writebig(char *s)
 {
+  // reach well into the double-indirect blocks.
+  enum { N = NDIRECT + NINDIRECT + 2*NINDIRECT + 10 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -586,7 +588,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < N; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +608,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != N){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -786,6 +788,292 @@ pipe1(char *s)
 }
 
 
+// splice a file into a pipe and a pipe into a file,
+// checking the bytes on the other side of each.
+void
+splicetest(char *s)
+{
+  int fds[2], fd, pid, xstatus;
+  int i, n, total;
+  enum { N=40, SZ=1031 };
+
+  unlink("splicef");
+  fd = open("splicef", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create splicef failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < N; n++){
+    for(i = 0; i < SZ; i++)
+      buf[i] = n*SZ + i;
+    if(write(fd, buf, SZ) != SZ){
+      printf("%s: write splicef failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // file -> pipe
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    total = 0;
+    while((n = read(fds[0], buf, SZ)) > 0){
+      for(i = 0; i < n; i++){
+        if((buf[i] & 0xff) != ((total + i) & 0xff)){
+          printf("%s: splice to pipe wrong byte\n", s);
+          exit(1);
+        }
+      }
+      total += n;
+    }
+    if(total != N*SZ){
+      printf("%s: splice to pipe total %d\n", s, total);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  fd = open("splicef", O_RDONLY);
+  total = 0;
+  while((n = splice(fd, fds[1], N*SZ - total)) > 0)
+    total += n;
+  close(fd);
+  close(fds[1]);
+  wait(&xstatus);
+  if(n < 0 || total != N*SZ || xstatus != 0){
+    printf("%s: splice file to pipe failed\n", s);
+    exit(1);
+  }
+
+  // pipe -> file
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < N; n++){
+      for(i = 0; i < SZ; i++)
+        buf[i] = ~(n*SZ + i);
+      if(write(fds[1], buf, SZ) != SZ){
+        printf("%s: write pipe failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  fd = open("splicef", O_RDWR);
+  total = 0;
+  while((n = splice(fds[0], fd, N*SZ)) > 0)
+    total += n;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(n < 0 || total != N*SZ || xstatus != 0){
+    printf("%s: splice pipe to file failed\n", s);
+    exit(1);
+  }
+
+  fd = open("splicef", O_RDONLY);
+  total = 0;
+  while((n = read(fd, buf, SZ)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (~(total + i) & 0xff)){
+        printf("%s: splice to file wrong byte\n", s);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  close(fd);
+  unlink("splicef");
+  if(total != N*SZ){
+    printf("%s: splice to file total %d\n", s, total);
+    exit(1);
+  }
+}
+
+// sleep() and nanosleep() wait at least as long as asked,
+// and a killed sleeper wakes up.
+void
+sleeptest(char *s)
+{
+  int t0, pid, xstatus, i;
+
+  t0 = uptime();
+  if(sleep(3) != 0 || uptime() - t0 < 3){
+    printf("%s: sleep(3) returned early\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  if(nanosleep(250000000) != 0 || uptime() - t0 < 2){
+    printf("%s: nanosleep returned early\n", s);
+    exit(1);
+  }
+
+  // 20 sleeps of 1ms must not each be rounded up to a tick.
+  t0 = uptime();
+  for(i = 0; i < 20; i++){
+    if(nanosleep(1000000) != 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  if(uptime() - t0 >= 10){
+    printf("%s: 20 1ms nanosleeps took %d ticks\n", s, uptime() - t0);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(1000000);
+    exit(0);
+  }
+  sleep(1);
+  kill(pid);
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: killed sleeper status %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// with tickless idle, harts with nothing to run stop their
+// tick; time must still advance, and sleepers still wake,
+// while this process spins and while everything sleeps.
+void
+ticklessidle(char *s)
+{
+  enum { NCHILD=3 };
+  int t0, i, pid, xstatus;
+  uint64 n;
+
+  t0 = uptime();
+  for(n = 0; uptime() - t0 < 3; n++){
+    if(n > 4000000000UL){
+      printf("%s: ticks stopped while spinning\n", s);
+      exit(1);
+    }
+  }
+
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      sleep(2 + i);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  if(uptime() - t0 < 1 + NCHILD){
+    printf("%s: sleepers woke early\n", s);
+    exit(1);
+  }
+}
+
+// buffered printf() to a pipe arrives whole and in order,
+// with nothing written twice by a fork() or lost at exit().
+void
+printfbuf(char *s)
+{
+  int fds[2], pid, xstatus, n, total, i;
+  enum { N=300 };
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    close(1);
+    dup(fds[1]);
+    close(fds[1]);
+    printf("x");
+    if((pid = fork()) == 0)
+      exit(0);
+    wait(0);
+    for(i = 0; i < N; i++)
+      printf("%d\n", i % 10);
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(total + i == 0)
+        c = 'x';
+      else if((total + i - 1) % 2 == 0)
+        c = '0' + (total + i - 1) / 2 % 10;
+      else
+        c = '\n';
+      if(buf[i] != c){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != 1 + 2*N || xstatus != 0){
+    printf("%s: read %d bytes, wanted %d\n", s, total, 1 + 2*N);
+    exit(1);
+  }
+}
+
+// the running program is paged in from its file, so the
+// kernel refuses to change that file underneath it.
+void
+textbusy(char *s)
+{
+  int fd;
+
+  if((fd = open("usertests", O_RDWR)) < 0)
+    return;  // not run from the root directory
+  if(write(fd, "x", 1) != -1){
+    printf("%s: wrote to a running program\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("usertests", O_RDWR|O_TRUNC)) >= 0){
+    printf("%s: truncated a running program\n", s);
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -1212,6 +1500,96 @@ fourfiles(char *s)
   }
 }
 
+// many processes run FS system calls at once, so that the log
+// seals and commits transactions while others begin; each
+// file must end up exactly as its writer left it.
+void
+groupcommit(char *s)
+{
+  enum { NCHILD=6, ROUNDS=8, SZ=BUFSZ };
+  char name[8];
+  int fd, pid, pi, r, i, n, total, xstatus;
+
+  for(pi = 0; pi < NCHILD; pi++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      name[0] = 'g';
+      name[1] = 'c';
+      name[2] = '0' + pi;
+      name[4] = 0;
+      for(r = 0; r < ROUNDS; r++){
+        // the last round's file is the one that stays.
+        name[3] = '0' + r;
+        fd = open(name, O_CREATE | O_RDWR);
+        if(fd < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+        for(i = 0; i < SZ; i++)
+          buf[i] = pi*ROUNDS + r + i;
+        // bigger than one transaction, so split by filewrite().
+        if(write(fd, buf, SZ) != SZ){
+          printf("%s: write %s failed\n", s, name);
+          exit(1);
+        }
+        close(fd);
+        if(r > 0){
+          name[3] = '0' + r - 1;
+          if(unlink(name) < 0){
+            printf("%s: unlink %s failed\n", s, name);
+            exit(1);
+          }
+        }
+      }
+      exit(0);
+    }
+  }
+
+  for(pi = 0; pi < NCHILD; pi++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+
+  for(pi = 0; pi < NCHILD; pi++){
+    name[0] = 'g';
+    name[1] = 'c';
+    name[2] = '0' + pi;
+    name[3] = '0' + ROUNDS - 1;
+    name[4] = 0;
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    total = 0;
+    while((n = read(fd, buf, BSIZE)) > 0){
+      for(i = 0; i < n; i++){
+        if((buf[i] & 0xff) != ((pi*ROUNDS + ROUNDS - 1 + total + i) & 0xff)){
+          printf("%s: %s wrong byte at %d\n", s, name, total + i);
+          exit(1);
+        }
+      }
+      total += n;
+    }
+    close(fd);
+    unlink(name);
+    if(total != SZ){
+      printf("%s: %s has %d bytes, not %d\n", s, name, total, SZ);
+      exit(1);
+    }
+    name[3] = '0' + ROUNDS - 2;
+    if(open(name, O_RDONLY) >= 0){
+      printf("%s: %s still exists\n", s, name);
+      exit(1);
+    }
+  }
+}
+
 // four processes create and delete different files in same directory
 void
 createdelete(char *s)
@@ -2594,6 +2972,11 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {splicetest, "splicetest"},
+  {sleeptest, "sleeptest"},
+  {ticklessidle, "ticklessidle"},
+  {printfbuf, "printfbuf"},
+  {textbusy, "textbusy"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2605,6 +2988,7 @@ struct test {
   {mem, "mem"},
   {sharedfd, "sharedfd"},
   {fourfiles, "fourfiles"},
+  {groupcommit, "groupcommit"},
   {createdelete, "createdelete"},
   {unlinkread, "unlinkread"},
   {linktest, "linktest"},
@@ -2924,6 +3308,150 @@ outofinodes(char *s)
   }
 }
 
+// how fork latency grows with the size of the parent.
+// with copy-on-write, fork only copies page tables and
+// bumps page reference counts, so the cost per page
+// should be small.
+void
+forkbench(char *s)
+{
+  enum { N = 50 };
+  int sizes[] = { 0, 64, 256, 1024, 4096 }; // KB of heap
+  char *top = sbrk(0);
+
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    uint64 want = (uint64)top + sizes[i]*1024;
+    uint64 cur = (uint64)sbrk(0);
+    if(want > cur && sbrk(want - cur) == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    // touch each page so that fork has something to share.
+    for(char *a = top; a < (char*)want; a += PGSIZE)
+      *a = 1;
+
+    int t0 = uptime();
+    for(int j = 0; j < N; j++){
+      int pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    int t1 = uptime();
+    printf("%s: %d KB: %d ticks for %d forks\n", s, sizes[i], t1 - t0, N);
+  }
+}
+
+// push data through a pipe with various write sizes,
+// and report the throughput.
+void
+pipebench(char *s)
+{
+  enum { TOTAL = 4*1024*1024 };
+  int sizes[] = { 1, 512, 4096, 8192 };
+  int fds[2], pid, n, cc, xstatus;
+
+  for(int i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    // writing a byte at a time is slow; don't push as much.
+    int total = sizes[i] < 512 ? TOTAL/64 : TOTAL;
+    if(pipe(fds) != 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    int t0 = uptime();
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      memset(buf, 'p', sizes[i]);
+      for(n = 0; n < total; n += sizes[i]){
+        if(write(fds[1], buf, sizes[i]) != sizes[i]){
+          printf("%s: pipe write failed\n", s);
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+    close(fds[1]);
+    n = 0;
+    while((cc = read(fds[0], buf, sizeof(buf))) > 0){
+      if(buf[0] != 'p' || buf[cc-1] != 'p'){
+        printf("%s: pipe read wrong data\n", s);
+        exit(1);
+      }
+      n += cc;
+    }
+    close(fds[0]);
+    wait(&xstatus);
+    if(xstatus != 0 || n != total){
+      printf("%s: read %d of %d bytes\n", s, n, total);
+      exit(1);
+    }
+    int t1 = uptime();
+    printf("%s: %d-byte writes: %d ticks for %d KB\n", s, sizes[i], t1 - t0, total/1024);
+  }
+}
+
+// create many files in one directory, which should take
+// about the same time per file however full it gets.
+void
+manyfiles(char *s)
+{
+  enum { N = 5000, STEP = 1000 };
+  int i, fd, t0, t1;
+  char name[8];
+
+  if(mkdir("mfdir") != 0 || chdir("mfdir") != 0){
+    printf("%s: mkdir mfdir failed\n", s);
+    exit(1);
+  }
+
+  name[0] = 'f';
+  name[5] = '\0';
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    name[1] = '0' + (i / 1000) % 10;
+    name[2] = '0' + (i / 100) % 10;
+    name[3] = '0' + (i / 10) % 10;
+    name[4] = '0' + i % 10;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if((i + 1) % STEP == 0){
+      t1 = uptime();
+      printf("%s: files %d-%d: %d ticks\n", s, i + 1 - STEP, i, t1 - t0);
+      t0 = t1;
+    }
+  }
+
+  for(i = 0; i < N; i++){
+    name[1] = '0' + (i / 1000) % 10;
+    name[2] = '0' + (i / 100) % 10;
+    name[3] = '0' + (i / 10) % 10;
+    name[4] = '0' + i % 10;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  chdir("..");
+  if(unlink("mfdir") != 0){
+    printf("%s: unlink mfdir failed\n", s);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +3459,9 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {forkbench, "forkbench"},
+  {manyfiles, "manyfiles"},
+  {pipebench, "pipebench"},
     
   { 0, 0},
 };
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("name", "label") makes the stub for SYS_name
+# under another label, for ulib.c to wrap.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
-entry("write");
-entry("close");
+entry("write", "_write");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -38,3 +41,5 @@ entry("sleep");
 entry("uptime");
 entry("history");
 entry("top");
+entry("splice");
+entry("nanosleep");